@@ -37,7 +37,7 @@ ConStatus OpenSprinkler::old_status;
 unsigned char OpenSprinkler::hw_type;
 unsigned char OpenSprinkler::hw_rev;
 unsigned char OpenSprinkler::nboards;
-unsigned char OpenSprinkler::nstations;
+sid_t OpenSprinkler::nstations;
 unsigned char OpenSprinkler::station_bits[MAX_NUM_BOARDS];
 unsigned char OpenSprinkler::engage_booster;
 uint16_t OpenSprinkler::baseline_current;
@@ -69,6 +69,15 @@ unsigned char OpenSprinkler::attrib_igrd[MAX_NUM_BOARDS];
 unsigned char OpenSprinkler::attrib_dis[MAX_NUM_BOARDS];
 unsigned char OpenSprinkler::attrib_spe[MAX_NUM_BOARDS];
 unsigned char OpenSprinkler::attrib_grp[MAX_NUM_STATIONS];
+uint16_t OpenSprinkler::attrib_flow[MAX_NUM_STATIONS];
+unsigned char OpenSprinkler::attrib_curr[MAX_NUM_STATIONS];
+sid_t OpenSprinkler::name_order[MAX_NUM_STATIONS];
+sid_t OpenSprinkler::name_order_n = 0;
+sid_t OpenSprinkler::spe_sids[MAX_NUM_STATIONS];
+sid_t OpenSprinkler::nspe_sids = 0;
+bool OpenSprinkler::spe_sids_valid = false;
+SpecialStation *OpenSprinkler::spe_data = NULL;
+bool OpenSprinkler::outputs_valid = false;
 unsigned char OpenSprinkler::masters[NUM_MASTER_ZONES][NUM_MASTER_OPTS];
 time_os_t OpenSprinkler::masters_last_on[NUM_MASTER_ZONES];
 RCSwitch OpenSprinkler::rfswitch;
@@ -108,6 +117,24 @@ extern unsigned char curr_alert_sid;
 	OTCConfig OpenSprinkler::otc;
 #endif
 
+#define OUTPUT_REFRESH_INTERVAL 10000UL // rewrite the station outputs at least this often, even if unchanged (in milli-seconds)
+#define SPECIAL_WORKERS      4       // threads sending remote/http station requests (RPI/LINUX)
+#define SPECIAL_RESULT_SIZE  32      // failed requests kept until the main loop collects them
+#define SPECIAL_RETRIES      2       // times a failed station request is sent again
+#define SPECIAL_BATCH_SIZE   16      // remote IP station switches sent in one request
+#define SPECIAL_NOBATCH_SIZE 8       // remote controllers remembered as not taking batched switches
+#define SPECIAL_FLUSH_TIME   10000UL // how long to wait for queued station requests before rebooting (in milli-seconds)
+#define HTTP_POOL_SIZE       8       // idle keep-alive connections kept for station requests (RPI/LINUX)
+#define HTTP_POOL_IDLE       30000UL // idle connections older than this are closed (in milli-seconds)
+#define RF_QUEUE_SIZE        32      // RF codes waiting for the transmit thread (RPI/LINUX)
+#define RF_TX_PRIORITY       50      // SCHED_FIFO priority of the RF transmit thread, if allowed (0: normal scheduling)
+
+#if defined(ARDUINO)
+	#define STATION_REQUEST_CONNECTION "Connection:close\r\n"
+#else
+	#define STATION_REQUEST_CONNECTION "Connection:keep-alive\r\n" // station requests go over pooled connections
+#endif
+
 /** Option json names (stored in PROGMEM to reduce RAM usage) */
 // IMPORTANT: each json name is strictly 5 characters
 // with 0 fillings if less
@@ -182,11 +209,13 @@ const char iopt_json_names[] PROGMEM =
 	"ife2\0"
 	"imin\0"
 	"imax\0"
-	"resv6"
-	"resv7"
-	"resv8"
+	"cwin\0"
+	"mcap\0"
+	"mcap2"
 	"wimod"
 	"reset"
+	"nsgrp"
+	"qmrg\0"
 	;
 
 /** Option prompts (stored in PROGMEM to reduce RAM usage) */
@@ -261,11 +290,13 @@ const char iopt_prompts[] PROGMEM =
 	"Notif 2 Enable  "
 	"I min threshold "
 	"I max limit     "
-	"Reserved 6      "
-	"Reserved 7      "
-	"Reserved 8      "
+	"Catch-up (min): "
+	"Mas1 capacity:  "
+	"Mas2 capacity:  "
 	"WiFi mode?      "
-	"Factory reset?  ";
+	"Factory reset?  "
+	"Seq. groups:    "
+	"Queue merge:    ";
 
 // string options do not have prompts
 
@@ -289,7 +320,7 @@ const unsigned char iopt_max[] PROGMEM = {
 	MAX_EXT_BOARDS,
 	1,
 	255,
-	MAX_NUM_STATIONS,
+	MAX_MASTER_STATION,
 	255,
 	255,
 	255,
@@ -308,7 +339,7 @@ const unsigned char iopt_max[] PROGMEM = {
 	255,
 	255,
 	1,
-	MAX_NUM_STATIONS,
+	MAX_MASTER_STATION,
 	255,
 	255,
 	0,
@@ -319,7 +350,7 @@ const unsigned char iopt_max[] PROGMEM = {
 	255,
 	255,
 	255,
-	1,
+	20,
 	255,
 	255,
 	1,
@@ -343,7 +374,9 @@ const unsigned char iopt_max[] PROGMEM = {
 	255,
 	255,
 	255,
-	1
+	1,
+	MAX_SEQ_GROUPS,
+	NUM_QUEUE_MERGE_POLICIES-1
 };
 
 // string options do not have maximum values
@@ -423,11 +456,13 @@ unsigned char OpenSprinkler::iopts[] = {
 	0,  // notif enable bits 2
 	DEFAULT_UNDERCURRENT_THRESHOLD/10, // imin threshold scaled down by 10
 	DEFAULT_OVERCURRENT_LIMIT/10,      // imax limit scaled down by 10
-	0,  // reserved 6
-	0,  // reserved 7
-	0,  // reserved 8
+	0,  // catch-up window: minutes skipped by a stalled loop or clock jump that are still checked (0: default, 255: off)
+	0,  // master flow capacity (0: unlimited)
+	0,  // master2 flow capacity (0: unlimited)
 	WIFI_MODE_AP, // wifi mode
-	0   // reset
+	0,  // reset
+	DEFAULT_SEQ_GROUPS, // number of sequential groups
+	QUEUE_MERGE_APPEND  // queue merge policy
 };
 
 /** String option values (stored in RAM) */
@@ -474,9 +509,11 @@ static const char months_str[] PROGMEM =
 
 #if !defined(ARDUINO)
 static inline int32_t now() {
-	time_t rawtime;
-	time(&rawtime);
-	return rawtime;
+	// not time(): it reads a coarse clock that can lag the start of a second
+	// by a few ms, while the main loop is woken up exactly at that start
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec;
 }
 #endif
 /** Calculate local time (UTC time plus time zone offset) */
@@ -794,6 +831,7 @@ bool OpenSprinkler::load_hardware_mac(unsigned char* mac, bool wired) {
 void OpenSprinkler::reboot_dev(uint8_t cause) {
 	nvdata.reboot_cause = cause;
 	nvdata_save();
+	flush_special_requests(SPECIAL_FLUSH_TIME); // let the remote stations know they have been turned off
 #if defined(DEMO)
 	// do nothing
 #else
@@ -1184,7 +1222,7 @@ void OpenSprinkler::latch_disable_alloutputs_v2() {
 /** Set one zone (for LATCH controller)
  *  This function sets one specified zone pin to a specified value
  */
-void OpenSprinkler::latch_setzonepin(unsigned char sid, unsigned char value) {
+void OpenSprinkler::latch_setzonepin(sid_t sid, unsigned char value) {
 	if(sid<8) { // on main controller
 		if(drio->type==IOEXP_TYPE_9555) { // LATCH contorller only uses PCA9555, no other type
 			uint16_t reg = drio->i2c_read(NXP_OUTPUT_REG);  // read current output reg value
@@ -1204,7 +1242,7 @@ void OpenSprinkler::latch_setzonepin(unsigned char sid, unsigned char value) {
 	}
 }
 
-void OpenSprinkler::latch_setzoneoutput_v2(unsigned char sid, unsigned char A, unsigned char K) {
+void OpenSprinkler::latch_setzoneoutput_v2(sid_t sid, unsigned char A, unsigned char K) {
 	if(A==HIGH && K==HIGH) return; // A and K must not be HIGH at the same time
 
 	if(sid<8) { // on main controller
@@ -1225,7 +1263,7 @@ void OpenSprinkler::latch_setzoneoutput_v2(unsigned char sid, unsigned char A, u
 /** LATCH open / close a station
  *
  */
-void OpenSprinkler::latch_open(unsigned char sid) {
+void OpenSprinkler::latch_open(sid_t sid) {
 	if(hw_rev>=2) {
 		DEBUG_PRINTLN(F("latch_open_v2"));
 		latch_disable_alloutputs_v2(); // disable all output pins
@@ -1250,7 +1288,7 @@ void OpenSprinkler::latch_open(unsigned char sid) {
 	}
 }
 
-void OpenSprinkler::latch_close(unsigned char sid) {
+void OpenSprinkler::latch_close(sid_t sid) {
 	if(hw_rev>=2) {
 		DEBUG_PRINTLN(F("latch_close_v2"));
 		latch_disable_alloutputs_v2(); // disable all output pins
@@ -1281,7 +1319,7 @@ void OpenSprinkler::latch_close(unsigned char sid) {
  */
 void OpenSprinkler::latch_apply_all_station_bits() {
 	if(hw_type==HW_TYPE_LATCH && engage_booster) {
-		for(unsigned char i=0;i<nstations;i++) {
+		for(sid_t i=0;i<nstations;i++) {
 			unsigned char bid=i>>3;
 			unsigned char s=i&0x07;
 			unsigned char mask=(unsigned char)1<<s;
@@ -1299,10 +1337,12 @@ void OpenSprinkler::latch_apply_all_station_bits() {
 }
 #endif
 
-/** Apply all station bits
+/** Write the station bits to the outputs (shift register or IO expanders)
+ * IO expanders only get written when their value changes; verify makes them
+ * check (read back or rewrite) that the outputs still hold the last written value
  * !!! This will activate/deactivate valves !!!
  */
-void OpenSprinkler::apply_all_station_bits(void (*post_activation_callback)()) {
+void OpenSprinkler::write_station_outputs(bool verify) {
 
 #if defined(ESP8266)
 	if(hw_type==HW_TYPE_LATCH) {
@@ -1322,29 +1362,32 @@ void OpenSprinkler::apply_all_station_bits(void (*post_activation_callback)()) {
 		}
 
 		// Handle driver board (on main controller)
+		if(verify) drio->output_verify();
 		if(drio->type==IOEXP_TYPE_9555) {
 			/* revision >= 1 uses PCA9555 with active high logic */
-			uint16_t reg = drio->i2c_read(NXP_OUTPUT_REG);  // read current output reg value
+			uint16_t reg = drio->i2c_read(NXP_OUTPUT_REG);  // current output reg value (from its shadow)
 			reg = (reg&0xFF00) | station_bits[0]; // output channels are the low 8-bit
-			drio->i2c_write(NXP_OUTPUT_REG, reg); // write value to register
+			drio->output_write(reg); // write value to register if changed
 		} else if(drio->type==IOEXP_TYPE_8574) {
 			/* revision 0 uses PCF8574 with active low logic, so all bits must be flipped */
-			drio->i2c_write(NXP_OUTPUT_REG, ~station_bits[0]);
+			drio->output_write(~station_bits[0]);
 		}
 
 		// Handle expansion boards
 		for(int i=0;i<MAX_EXT_BOARDS/2;i++) {
+			if(expanders[i]->type==IOEXP_TYPE_NONEXIST) continue;
+			if(verify) expanders[i]->output_verify();
 			uint16_t data = station_bits[i*2+2];
 			data = (data<<8) + station_bits[i*2+1];
 			if(expanders[i]->type==IOEXP_TYPE_9555) {
-				expanders[i]->i2c_write(NXP_OUTPUT_REG, data);
+				expanders[i]->output_write(data);
 			} else {
-				expanders[i]->i2c_write(NXP_OUTPUT_REG, ~data);
+				expanders[i]->output_write(~data);
 			}
 		}
 	}
 
-#else
+#elif defined(ARDUINO)
 	digitalWrite(PIN_SR_LATCH, LOW);
 	unsigned char bid, s, sbits;
 
@@ -1358,16 +1401,11 @@ void OpenSprinkler::apply_all_station_bits(void (*post_activation_callback)()) {
 
 		for(s=0;s<8;s++) {
 			digitalWrite(PIN_SR_CLOCK, LOW);
-	#if defined(OSPI) // if OSPI, use dynamically assigned pin_sr_data
-			digitalWrite(pin_sr_data, (sbits & ((unsigned char)1<<(7-s))) ? HIGH : LOW );
-	#else
 			digitalWrite(PIN_SR_DATA, (sbits & ((unsigned char)1<<(7-s))) ? HIGH : LOW );
-	#endif
 			digitalWrite(PIN_SR_CLOCK, HIGH);
 		}
 	}
 
-	#if defined(ARDUINO)
 	if((hw_type==HW_TYPE_DC) && engage_booster) {
 		// for DC controller: boost voltage
 		digitalWrite(PIN_BOOST_EN, LOW);  // disable output path
@@ -1381,41 +1419,77 @@ void OpenSprinkler::apply_all_station_bits(void (*post_activation_callback)()) {
 	} else {
 		digitalWrite(PIN_SR_LATCH, HIGH);
 	}
+#else
+	// Shift out all station bit values, from the highest board to the lowest.
+	// The whole chain is always written: the physical chain can be longer than nboards,
+	// and a shorter write would move the bits of the first boards into the ones beyond it
+	unsigned char bytes[MAX_NUM_BOARDS];
+	for(unsigned char bid=0;bid<=MAX_EXT_BOARDS;bid++) {
+		bytes[bid] = status.enabled ? station_bits[MAX_EXT_BOARDS-bid] : 0;
+	}
+	#if defined(OSPI) // if OSPI, use dynamically assigned pin_sr_data
+	shift_out_latch(PIN_SR_LATCH, PIN_SR_CLOCK, pin_sr_data, bytes, MAX_NUM_BOARDS);
 	#else
-	digitalWrite(PIN_SR_LATCH, HIGH);
+	shift_out_latch(PIN_SR_LATCH, PIN_SR_CLOCK, PIN_SR_DATA, bytes, MAX_NUM_BOARDS);
 	#endif
 #endif
+}
+
+/** Apply all station bits
+ * The outputs are only rewritten when a bit has changed since the last write,
+ * and every OUTPUT_REFRESH_INTERVAL in case an output has been disturbed
+ */
+void OpenSprinkler::apply_all_station_bits(void (*post_activation_callback)()) {
+	static unsigned char applied_bits[MAX_NUM_BOARDS];
+	static unsigned char applied_enabled = 0;
+	static ulong applied_ms = 0;
+	ulong ms = millis();
+	bool refresh = !outputs_valid || ms-applied_ms>=OUTPUT_REFRESH_INTERVAL;
+	if(refresh || engage_booster || applied_enabled!=status.enabled ||
+		memcmp(applied_bits, station_bits, MAX_NUM_BOARDS)!=0) {
+		write_station_outputs(refresh);
+		memcpy(applied_bits, station_bits, MAX_NUM_BOARDS);
+		applied_enabled = status.enabled;
+		if(refresh) applied_ms = ms;
+		outputs_valid = true;
+	}
 
 	// If a post activation callback function is defined, call it here
 	if(post_activation_callback) post_activation_callback();
 
 	if(iopts[IOPT_SPE_AUTO_REFRESH]) {
 		// handle refresh of RF and remote stations
-		// we refresh the station that's next in line
-		static unsigned char next_sid_to_refresh = MAX_NUM_STATIONS>>1;
+		// each second we refresh the next IOPT_SPE_AUTO_REFRESH special stations in line
+		static sid_t next_spe_to_refresh = 0;
 		static unsigned char lastnow = 0;
 		time_os_t curr_time = now_tz();
 		unsigned char _now = (curr_time & 0xFF);
 		if (lastnow != _now) {  // perform this no more than once per second
 			lastnow = _now;
-			next_sid_to_refresh = (next_sid_to_refresh+1) % MAX_NUM_STATIONS;
-			unsigned char bid=next_sid_to_refresh>>3,s=next_sid_to_refresh&0x07;
-			if(os.attrib_spe[bid]&(1<<s)) { // check if this is a special station
-				bid=next_sid_to_refresh>>3;
-				s=next_sid_to_refresh&0x07;
+			if(!spe_sids_valid) spe_sids_build();
+			sid_t budget = iopts[IOPT_SPE_AUTO_REFRESH];
+			if(budget>nspe_sids) budget = nspe_sids;
+			for(;budget>0;budget--) {
+				if(next_spe_to_refresh>=nspe_sids) next_spe_to_refresh = 0;
+				sid_t sid = spe_sids[next_spe_to_refresh++];
+				unsigned char bid=sid>>3,s=sid&0x07;
 				bool on = (station_bits[bid]>>s)&0x01;
 				uint16_t dur = 0;
 				if(on) {
-					unsigned char sqi=pd.station_qid[next_sid_to_refresh];
+					qid_t sqi=pd.station_qid[sid];
 					RuntimeQueueStruct *q=pd.queue+sqi;
-					if(sqi<255 && q->st>0 && q->st+q->dur>curr_time) {
+					if(sqi!=QID_NONE && q->st>0 && q->st+q->dur>curr_time) {
 						dur = q->st+q->dur-curr_time;
 					}
 				}
-				switch_special_station(next_sid_to_refresh, on, dur);
+				switch_special_station(sid, on, dur);
 			}
 		}
 	}
+
+#if !defined(ARDUINO)
+	release_special_requests(); // the remote stations switched along with these bits go out together
+#endif
 }
 
 /** Read rain sensor status */
@@ -1626,44 +1700,106 @@ bool OpenSprinkler::parse_rfstation_code(RFStationData *data, RFStationCode *cod
 }
 
 /** Get station data */
-void OpenSprinkler::get_station_data(unsigned char sid, StationData* data) {
+void OpenSprinkler::get_station_data(sid_t sid, StationData* data) {
 	file_read_block(STATIONS_FILENAME, data, (uint32_t)sid*sizeof(StationData), sizeof(StationData));
 }
 
 /** Set station data */
 /*
-void OpenSprinkler::set_station_data(unsigned char sid, StationData* data) {
+void OpenSprinkler::set_station_data(sid_t sid, StationData* data) {
 	file_write_block(STATIONS_FILENAME, data, (uint32_t)sid*sizeof(StationData), sizeof(StationData));
 }
 */
 
 /** Get station name */
-void OpenSprinkler::get_station_name(unsigned char sid, char tmp[]) {
+void OpenSprinkler::get_station_name(sid_t sid, char tmp[]) {
 	tmp[STATION_NAME_SIZE]=0;
 	file_read_block(STATIONS_FILENAME, tmp, (uint32_t)sid*sizeof(StationData)+offsetof(StationData, name), STATION_NAME_SIZE);
 }
 
 /** Set station name */
-void OpenSprinkler::set_station_name(unsigned char sid, char tmp[]) {
+void OpenSprinkler::set_station_name(sid_t sid, char tmp[]) {
 	tmp[STATION_NAME_SIZE]=0;
 	char n0[STATION_NAME_SIZE+1];
 	get_station_name(sid, n0);
 	size_t len = strlen(n0);
 	if(len!=strlen(tmp) || memcmp(n0, tmp, len)!=0) { // only write if the name has changed
 		file_write_block(STATIONS_FILENAME, tmp, (uint32_t)sid*sizeof(StationData)+offsetof(StationData, name), STATION_NAME_SIZE);
+		if(sid<name_order_n) { // move the station to its new place in the name order
+			sid_t i;
+			for(i=0;name_order[i]!=sid;i++);
+			memmove(name_order+i, name_order+i+1, (name_order_n-1-i)*sizeof(sid_t));
+			name_order_insert(sid, tmp, name_order_n-1);
+		}
 	}
 }
 
+/** Insert sid into the first n (sorted) entries of name_order
+ * using a binary search, which reads log2(n) names from file
+ */
+void OpenSprinkler::name_order_insert(sid_t sid, const char *name, sid_t n) {
+	char buf[STATION_NAME_SIZE+1];
+	sid_t lo = 0, hi = n, mid;
+	while(lo<hi) {
+		mid = lo+(hi-lo)/2;
+		get_station_name(name_order[mid], buf);
+		int c = strcmp(buf, name);
+		if(c<0 || (c==0 && name_order[mid]<sid)) lo = mid+1;
+		else hi = mid;
+	}
+	memmove(name_order+lo+1, name_order+lo, (n-lo)*sizeof(sid_t));
+	name_order[lo] = sid;
+}
+
+static const char *sort_names; // names being sorted by get_name_order, STATION_NAME_SIZE+1 bytes each
+
+static int by_name(const void *a, const void *b) {
+	sid_t x = *(const sid_t*)a, y = *(const sid_t*)b;
+	int c = strcmp(sort_names+(ulong)x*(STATION_NAME_SIZE+1), sort_names+(ulong)y*(STATION_NAME_SIZE+1));
+	return c ? c : (x>y)-(x<y);
+}
+
+/** Station ids 0..nstations-1 sorted by name
+ * Built once and then kept up to date by set_station_name,
+ * so that name-ordered programs don't have to read and sort all names.
+ * The names are read in one pass and sorted in memory; if there isn't
+ * enough memory, they are inserted one by one, reading names from file
+ */
+const sid_t* OpenSprinkler::get_name_order() {
+	if(name_order_n!=nstations) {
+		sid_t n = nstations;
+		char *names = (char*)malloc((ulong)n*(STATION_NAME_SIZE+1));
+		if(names) {
+			file_read_fields(STATIONS_FILENAME, names, offsetof(StationData, name), sizeof(StationData), STATION_NAME_SIZE+1, n);
+			for(sid_t sid=0;sid<n;sid++) {
+				names[(ulong)sid*(STATION_NAME_SIZE+1)+STATION_NAME_SIZE] = 0;
+				name_order[sid] = sid;
+			}
+			sort_names = names;
+			qsort(name_order, n, sizeof(sid_t), by_name);
+			free(names);
+		} else {
+			char buf[STATION_NAME_SIZE+1];
+			for(sid_t sid=0;sid<n;sid++) {
+				get_station_name(sid, buf);
+				name_order_insert(sid, buf, sid);
+			}
+		}
+		name_order_n = n;
+	}
+	return name_order;
+}
+
 /** Get station type */
-unsigned char OpenSprinkler::get_station_type(unsigned char sid) {
+unsigned char OpenSprinkler::get_station_type(sid_t sid) {
 	return file_read_byte(STATIONS_FILENAME, (uint32_t)sid*sizeof(StationData)+offsetof(StationData, type));
 }
 
-unsigned char OpenSprinkler::is_sequential_station(unsigned char sid) {
+unsigned char OpenSprinkler::is_sequential_station(sid_t sid) {
 	return attrib_grp[sid] != PARALLEL_GROUP_ID;
 }
 
-unsigned char OpenSprinkler::is_master_station(unsigned char sid) {
+unsigned char OpenSprinkler::is_master_station(sid_t sid) {
 	for (unsigned char mas = 0; mas < NUM_MASTER_ZONES; mas++) {
 		if (get_master_id(mas) && (get_master_id(mas) - 1 == sid)) {
 			return 1;
@@ -1672,7 +1808,7 @@ unsigned char OpenSprinkler::is_master_station(unsigned char sid) {
 	return 0;
 }
 
-unsigned char OpenSprinkler::is_running(unsigned char sid) {
+unsigned char OpenSprinkler::is_running(sid_t sid) {
 	return station_bits[(sid >> 3)] >> (sid & 0x07) & 1;
 }
 
@@ -1699,7 +1835,7 @@ int16_t OpenSprinkler::get_imax() {
 	return (i == 0) ? DEFAULT_OVERCURRENT_LIMIT : (i == 255 ? -1 : i*10);
 }
 
-unsigned char OpenSprinkler::bound_to_master(unsigned char sid, unsigned char mas) {
+unsigned char OpenSprinkler::bound_to_master(sid_t sid, unsigned char mas) {
 	unsigned char bid = sid >> 3;
 	unsigned char s = sid & 0x07;
 	unsigned char attributes = 0;
@@ -1718,18 +1854,80 @@ unsigned char OpenSprinkler::bound_to_master(unsigned char sid, unsigned char ma
 	return attributes & (1 << s);
 }
 
-unsigned char OpenSprinkler::get_station_gid(unsigned char sid) {
-	return attrib_grp[sid];
+/** Sequential group of a station
+ * Stations assigned to a group beyond the configured number of groups
+ * run in the last group
+ */
+unsigned char OpenSprinkler::get_station_gid(sid_t sid) {
+	unsigned char gid = attrib_grp[sid];
+	unsigned char n = get_num_seq_groups();
+	return (gid == PARALLEL_GROUP_ID || gid < n) ? gid : n-1;
+}
+
+unsigned char OpenSprinkler::get_num_seq_groups() {
+	unsigned char n = iopts[IOPT_SEQ_GROUPS];
+	return (n == 0) ? 1 : (n > MAX_SEQ_GROUPS ? MAX_SEQ_GROUPS : n);
 }
 
-void OpenSprinkler::set_station_gid(unsigned char sid, unsigned char gid) {
+void OpenSprinkler::set_station_gid(sid_t sid, unsigned char gid) {
 	attrib_grp[sid] = gid;
 }
 
+uint16_t OpenSprinkler::get_station_flow(sid_t sid) {
+	return attrib_flow[sid] & ~STATION_FLOW_FIXED;
+}
+
+/** Update the learned flow rate of a station (x100)
+ * Rates entered by hand are kept. Measurements are averaged,
+ * and only written to file when the rate changes noticeably.
+ */
+void OpenSprinkler::learn_station_flow(sid_t sid, uint16_t flow) {
+	uint16_t old = attrib_flow[sid];
+	if (old & STATION_FLOW_FIXED) return;
+	if (flow >= STATION_FLOW_FIXED) flow = STATION_FLOW_FIXED-1;
+	attrib_flow[sid] = old ? (uint16_t)(((uint32_t)old*3+flow)/4) : flow;
+
+	uint16_t saved;
+	uint32_t pos = (uint32_t)sid*sizeof(StationData)+offsetof(StationData, attrib)+offsetof(StationAttrib, flow);
+	file_read_block(STATIONS_FILENAME, &saved, pos, sizeof(saved));
+	uint16_t diff = (attrib_flow[sid]>saved) ? attrib_flow[sid]-saved : saved-attrib_flow[sid];
+	if (diff > saved/16) {
+		file_write_block(STATIONS_FILENAME, &attrib_flow[sid], pos, sizeof(saved));
+	}
+}
+
+uint32_t OpenSprinkler::get_master_capacity(unsigned char mas) {
+	return (uint32_t)iopts[mas==MASTER_1 ? IOPT_MASTER_CAPACITY : IOPT_MASTER_CAPACITY_2]*100;
+}
+
+uint16_t OpenSprinkler::get_station_current(sid_t sid) {
+	return (uint16_t)attrib_curr[sid]*10;
+}
+
+/** Update the learned current of a station (in mA, resting current excluded) */
+void OpenSprinkler::learn_station_current(sid_t sid, uint16_t current) {
+	current = (current+5)/10;
+	if (current > 255) current = 255;
+	if (!current) return;
+	unsigned char old = attrib_curr[sid];
+	attrib_curr[sid] = old ? (unsigned char)((old*3+current+2)/4) : (unsigned char)current;
+}
+
+/** Current left for the stations, after the resting current
+ * and a safety margin are taken off the overcurrent limit
+ */
+uint16_t OpenSprinkler::get_current_budget() {
+	int16_t imax = get_imax();
+	if (imax < 0) return 0;
+	int16_t budget = imax - (int16_t)baseline_current - CURRENT_BUDGET_MARGIN;
+	return (budget > 0) ? budget : 0;
+}
+
 /** Save all station attribs to file (backward compatibility) */
 void OpenSprinkler::attribs_save() {
 	// re-package attribute bits and save
-	unsigned char bid, s, sid=0;
+	unsigned char bid, s;
+	sid_t sid=0;
 	StationAttrib at, at0;
 	memset(&at, 0, sizeof(StationAttrib));
 	unsigned char ty = STN_TYPE_STANDARD, ty0;
@@ -1741,8 +1939,8 @@ void OpenSprinkler::attribs_save() {
 			at.igs2= (attrib_igs2[bid]>>s) & 1;
 			at.igrd= (attrib_igrd[bid]>>s) & 1;
 			at.dis = (attrib_dis[bid]>>s) & 1;
-			at.gid = get_station_gid(sid);
-			set_station_gid(sid, at.gid);
+			at.gid = attrib_grp[sid]; // save the assigned group, even if it's beyond the configured number of groups
+			at.flow = attrib_flow[sid];
 
 			// only write if content has changed: this is important for LittleFS as otherwise the overhead is too large
 			file_read_block(STATIONS_FILENAME, &at0, (uint32_t)sid*sizeof(StationData)+offsetof(StationData, attrib), sizeof(StationAttrib));
@@ -1759,12 +1957,15 @@ void OpenSprinkler::attribs_save() {
 			}
 		}
 	}
+	pd.invalidate_master_windows(); // master bindings may have changed
+	spe_sids_valid = false;
 }
 
 /** Load all station attribs from file (backward compatibility) */
 void OpenSprinkler::attribs_load() {
 	// load and re-package attributes
-	unsigned char bid, s, sid=0;
+	unsigned char bid, s;
+	sid_t sid=0;
 	StationAttrib at;
 	unsigned char ty;
 	memset(attrib_mas, 0, nboards);
@@ -1775,6 +1976,7 @@ void OpenSprinkler::attribs_load() {
 	memset(attrib_dis, 0, nboards);
 	memset(attrib_spe, 0, nboards);
 	memset(attrib_grp, 0, MAX_NUM_STATIONS);
+	memset(attrib_flow, 0, sizeof(attrib_flow));
 
 	for(bid=0;bid<MAX_NUM_BOARDS;bid++) {
 		for(s=0;s<8;s++,sid++) {
@@ -1786,12 +1988,102 @@ void OpenSprinkler::attribs_load() {
 			attrib_igrd[bid]|= (at.igrd<<s);
 			attrib_dis[bid] |= (at.dis<<s);
 			attrib_grp[sid] = at.gid;
+			attrib_flow[sid] = at.flow;
 			file_read_block(STATIONS_FILENAME, &ty, (uint32_t)sid*sizeof(StationData)+offsetof(StationData, type), 1);
 			if(ty!=STN_TYPE_STANDARD) {
 				attrib_spe[bid] |= (1<<s);
 			}
 		}
 	}
+	pd.invalidate_master_windows();
+	spe_sids_valid = false;
+}
+
+/** Collect the special stations into spe_sids, which auto refresh cycles through,
+ * and decode their data into spe_data
+ */
+void OpenSprinkler::spe_sids_build() {
+	for(sid_t i=0;i<nspe_sids;i++) free(spe_data[i].text);
+	nspe_sids = 0;
+	for(sid_t sid=0;sid<MAX_NUM_STATIONS;sid++) {
+		if(attrib_spe[sid>>3]&(1<<(sid&0x07))) spe_sids[nspe_sids++] = sid;
+	}
+	free(spe_data);
+	spe_data = nspe_sids ? (SpecialStation*)malloc(nspe_sids*sizeof(SpecialStation)) : NULL;
+	if(!spe_data) nspe_sids = 0;
+	for(sid_t i=0;i<nspe_sids;i++) spe_decode(spe_sids[i], spe_data+i);
+	spe_sids_valid = true;
+}
+
+/** Read and decode the special data of a station */
+void OpenSprinkler::spe_decode(sid_t sid, SpecialStation *spe) {
+	memset(spe, 0, sizeof(SpecialStation));
+	StationData *pdata=(StationData*) tmp_buffer;
+	get_station_data(sid, pdata);
+	spe->type = pdata->type;
+	switch(spe->type) {
+
+	case STN_TYPE_RF:
+		parse_rfstation_code((RFStationData *)pdata->sped, &spe->rf);
+		break;
+
+	case STN_TYPE_REMOTE_IP: {
+		RemoteIPStationData *data = (RemoteIPStationData *)pdata->sped;
+		spe->ip4 = hex2ulong(data->ip, sizeof(data->ip));
+		spe->port = (uint16_t)hex2ulong(data->port, sizeof(data->port));
+		spe->rsid = (uint16_t)hex2ulong(data->sid, sizeof(data->sid));
+		} break;
+
+	case STN_TYPE_REMOTE_OTC: {
+		RemoteOTCStationData *data = (RemoteOTCStationData *)pdata->sped;
+		spe->rsid = (uint16_t)hex2ulong(data->sid, sizeof(data->sid));
+		spe->text = (char*)malloc(sizeof(data->token));
+		if(spe->text) {
+			memcpy(spe->text, data->token, sizeof(data->token)-1);
+			spe->text[sizeof(data->token)-1] = 0; // ensure the string ends properly
+		}
+		} break;
+
+	case STN_TYPE_GPIO: {
+		GPIOStationData *data = (GPIOStationData *)pdata->sped;
+		spe->pin = (data->pin[0] - '0') * 10 + (data->pin[1] - '0');
+		spe->active = data->active - '0';
+		} break;
+
+	case STN_TYPE_HTTP:
+	case STN_TYPE_HTTPS: {
+		// server,port,on_cmd,off_cmd
+		spe->text = (char*)malloc(STATION_SPECIAL_DATA_SIZE+1);
+		if(!spe->text) break;
+		memcpy(spe->text, pdata->sped, STATION_SPECIAL_DATA_SIZE);
+		spe->text[STATION_SPECIAL_DATA_SIZE] = 0;
+		spe->server = strtok(spe->text, ",");
+		char *port = strtok(NULL, ",");
+		spe->on_cmd = strtok(NULL, ",");
+		spe->off_cmd = strtok(NULL, ",");
+		spe->port = port ? atoi(port) : 0;
+		} break;
+	}
+}
+
+/** Decoded special data of a station, or NULL if it is not a special station */
+const SpecialStation* OpenSprinkler::get_special_station(sid_t sid) {
+	if(!spe_sids_valid) spe_sids_build();
+	sid_t lo = 0, hi = nspe_sids, mid;
+	while(lo<hi) {
+		mid = lo+(hi-lo)/2;
+		if(spe_sids[mid]<sid) lo = mid+1;
+		else hi = mid;
+	}
+	return (lo<nspe_sids && spe_sids[lo]==sid) ? spe_data+lo : NULL;
+}
+
+/** Remote on-timer under auto refresh: a few full refresh cycles, at least a minute */
+uint16_t OpenSprinkler::spe_refresh_timer() {
+	if(!spe_sids_valid) spe_sids_build();
+	unsigned char rate = iopts[IOPT_SPE_AUTO_REFRESH];
+	uint16_t cycle = (nspe_sids+rate-1)/rate;
+	return (cycle<15) ? 60 : 4*cycle;
 }
 
 /** verify if a string matches password */
@@ -1817,42 +2109,35 @@ unsigned char OpenSprinkler::weekday_today() {
 }
 
 /** Switch special station */
-void OpenSprinkler::switch_special_station(unsigned char sid, unsigned char value, uint16_t dur) {
+void OpenSprinkler::switch_special_station(sid_t sid, unsigned char value, uint16_t dur) {
 	// check if this is a special station
 	unsigned char bid=sid>>3,s=sid&0x07;
 	if(!(os.attrib_spe[bid]&(1<<s))) return; // if this is not a special stations
-	unsigned char stype = get_station_type(sid);
-	if(stype!=STN_TYPE_STANDARD) {
-		// read station data
-		StationData *pdata=(StationData*) tmp_buffer;
-		get_station_data(sid, pdata);
-		switch(stype) {
-
-		case STN_TYPE_RF:
-			switch_rfstation((RFStationData *)pdata->sped, value);
-			break;
+	const SpecialStation *spe = get_special_station(sid);
+	if(!spe) return;
+	switch(spe->type) {
 
-		case STN_TYPE_REMOTE_IP:
-			switch_remotestation((RemoteIPStationData *)pdata->sped, value, dur);
-			break;
+	case STN_TYPE_RF:
+		switch_rfstation(spe, value);
+		break;
 
-		case STN_TYPE_REMOTE_OTC:
-			switch_remotestation((RemoteOTCStationData *)pdata->sped, value, dur);
-			break;
+	case STN_TYPE_REMOTE_IP:
+	case STN_TYPE_REMOTE_OTC:
+		switch_remotestation(spe, value, dur, sid);
+		break;
 
-		case STN_TYPE_GPIO:
-			switch_gpiostation((GPIOStationData *)pdata->sped, value);
-			break;
+	case STN_TYPE_GPIO:
+		switch_gpiostation(spe, value);
+		break;
 
-		case STN_TYPE_HTTP:
-			switch_httpstation((HTTPStationData *)pdata->sped, value, false);
-			break;
+	case STN_TYPE_HTTP:
+		switch_httpstation(spe, value, false, sid);
+		break;
 
-		case STN_TYPE_HTTPS:
-			switch_httpstation((HTTPStationData *)pdata->sped, value, true);
-			break;
+	case STN_TYPE_HTTPS:
+		switch_httpstation(spe, value, true, sid);
+		break;
 
-		}
 	}
 }
 
@@ -1861,7 +2146,7 @@ void OpenSprinkler::switch_special_station(unsigned char sid, unsigned char valu
  * You have to call apply_all_station_bits next to apply the bits
  * (which results in physical actions of opening/closing valves).
  */
-unsigned char OpenSprinkler::set_station_bit(unsigned char sid, unsigned char value, uint16_t dur) {
+unsigned char OpenSprinkler::set_station_bit(sid_t sid, unsigned char value, uint16_t dur) {
 	unsigned char *data = station_bits+(sid>>3);  // pointer to the station byte
 	unsigned char mask = (unsigned char)1<<(sid&0x07); // mask
 	if (value) {
@@ -1887,7 +2172,7 @@ unsigned char OpenSprinkler::set_station_bit(unsigned char sid, unsigned char va
 	return 0;
 }
 
-unsigned char OpenSprinkler::get_station_bit(unsigned char sid) {
+unsigned char OpenSprinkler::get_station_bit(sid_t sid) {
 	unsigned char *data = station_bits+(sid>>3); // pointer to the station byte
 	unsigned char mask = (unsigned char)1<<(sid&0x07); // mask
 	if ((*data)&mask) return 1;
@@ -1896,23 +2181,120 @@ unsigned char OpenSprinkler::get_station_bit(unsigned char sid) {
 
 /** Clear all station bits */
 void OpenSprinkler::clear_all_station_bits() {
-	unsigned char sid;
+	sid_t sid;
 	for(sid=0;sid<MAX_NUM_STATIONS;sid++) {
 		set_station_bit(sid, 0);
 	}
 }
 
-/** Switch RF station
- * This function takes a RF code,
- * parses it into signals and timing,
- * and sends it out through RF transmitter.
+#if !defined(ARDUINO)
+/** RF transmit thread (RPI/LINUX)
+ * Sending a code bit-bangs every repeat of it, which takes tens of milli-seconds.
+ * The main loop only queues the codes, and a dedicated thread (SCHED_FIFO where
+ * permitted, for steady pulse timing) sends them with its own RCSwitch.
+ * Only used with the gpiod backend, as the thread drives PIN_RFTX through it.
+ * A code still in the queue is replaced by a newer command for the same station.
  */
-void OpenSprinkler::switch_rfstation(RFStationData *data, bool turnon) {
+#include <pthread.h>
+#include <sched.h>
+
+struct RFTransmission {
 	RFStationCode code;
-	if(!parse_rfstation_code(data, &code)) return; // return if the timing parameter is 0
+	bool turnon;
+};
+
+static RCSwitch rf_tx;
+static RFTransmission rf_queue[RF_QUEUE_SIZE];
+static unsigned char rf_head = 0;
+static unsigned char rf_count = 0;
+static bool rf_sending = false;  // the thread is sending a code taken from the queue
+static bool rf_started = false;
+static bool rf_failed = false;   // the thread could not be started: send from the main loop
+static pthread_mutex_t rf_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t rf_cond = PTHREAD_COND_INITIALIZER;  // the queue or rf_sending has changed
+
+static void *rf_worker(void *) {
+	pthread_mutex_lock(&rf_lock);
+	for(;;) {
+		while(!rf_count) pthread_cond_wait(&rf_cond, &rf_lock);
+		RFTransmission t = rf_queue[rf_head];
+		rf_head = (rf_head+1) % RF_QUEUE_SIZE;
+		rf_count--;
+		rf_sending = true;
+		pthread_cond_broadcast(&rf_cond);
+		pthread_mutex_unlock(&rf_lock);
+
+		rf_tx.setProtocol(t.code.protocol);
+		rf_tx.setPulseLength(t.code.timing);
+		rf_tx.send(t.turnon ? t.code.on : t.code.off, t.code.bitlength);
+
+		pthread_mutex_lock(&rf_lock);
+		rf_sending = false;
+		pthread_cond_broadcast(&rf_cond);
+	}
+	return NULL;
+}
+
+/** Queue a code for the transmit thread, starting it at first use.
+ * Returns false if there is no thread, in which case the caller sends the code itself
+ */
+static bool rf_enqueue(const RFStationCode &code, bool turnon) {
+	if(!rf_started) {
+		// the simulated backend is not thread safe: its codes are sent from the main loop
+		if(rf_failed || gpio_backend()==&sim_gpio) return false;
+		rf_tx.enableTransmit(PIN_RFTX); // the pin is set up here, the thread only writes to it
+		pthread_t t;
+		if(pthread_create(&t, NULL, rf_worker, NULL)!=0) {
+			DEBUG_PRINTLN("RF transmit thread not started");
+			rf_failed = true;
+			return false;
+		}
+		#if RF_TX_PRIORITY>0
+		struct sched_param sp;
+		sp.sched_priority = RF_TX_PRIORITY;
+		if(pthread_setschedparam(t, SCHED_FIFO, &sp)!=0) {
+			DEBUG_PRINTLN("RF transmit thread runs without SCHED_FIFO");
+		}
+		#endif
+		pthread_detach(t);
+		rf_started = true;
+	}
+	pthread_mutex_lock(&rf_lock);
+	unsigned char i;
+	for(i=0;i<rf_count;i++) {
+		RFTransmission *q = rf_queue + (rf_head+i) % RF_QUEUE_SIZE;
+		if(q->code.on==code.on && q->code.off==code.off && q->code.protocol==code.protocol) {
+			q->turnon = turnon; // same station: only its latest command is sent
+			break;
+		}
+	}
+	if(i==rf_count) {
+		while(rf_count==RF_QUEUE_SIZE) pthread_cond_wait(&rf_cond, &rf_lock);
+		RFTransmission *q = rf_queue + (rf_head+rf_count) % RF_QUEUE_SIZE;
+		q->code = code;
+		q->turnon = turnon;
+		rf_count++;
+		pthread_cond_broadcast(&rf_cond);
+	}
+	pthread_mutex_unlock(&rf_lock);
+	return true;
+}
+#endif
+
+/** Switch RF station
+ * This function takes a decoded RF code
+ * and sends it out through RF transmitter
+ * (on RPI/LINUX, it queues the code for the transmit thread).
+ */
+void OpenSprinkler::switch_rfstation(const SpecialStation *spe, bool turnon) {
+	const RFStationCode &code = spe->rf;
+	if(!code.timing) return; // return if the timing parameter is 0
 
 	if(PIN_RFTX == 255) return; // ignore RF station if RF pin disabled
 
+#if !defined(ARDUINO)
+	if(rf_enqueue(code, turnon)) return;
+#endif
 	rfswitch.enableTransmit(PIN_RFTX);
 	rfswitch.setProtocol(code.protocol);
 	rfswitch.setPulseLength(code.timing);
@@ -1920,13 +2302,14 @@ void OpenSprinkler::switch_rfstation(RFStationData *data, bool turnon) {
 }
 
 /** Switch GPIO station
- * Special data for GPIO Station is three bytes of ascii decimal (not hex)
+ * The pin and active level are decoded by spe_decode from the special data,
+ * which for GPIO Station is three bytes of ascii decimal (not hex)
  * First two bytes are zero padded GPIO pin number.
  * Third byte is either 0 or 1 for active low (GND) or high (+5V) relays
  */
-void OpenSprinkler::switch_gpiostation(GPIOStationData *data, bool turnon) {
-	unsigned char gpio = (data->pin[0] - '0') * 10 + (data->pin[1] - '0');
-	unsigned char activeState = data->active - '0';
+void OpenSprinkler::switch_gpiostation(const SpecialStation *spe, bool turnon) {
+	unsigned char gpio = spe->pin;
+	unsigned char activeState = spe->active;
 
 	pinMode(gpio, OUTPUT);
 	if (turnon)
@@ -1942,7 +2325,8 @@ void default_http_callback(char* buffer) {
 
 }
 
-int8_t OpenSprinkler::send_http_request(const char* server, uint16_t port, char* p, void(*callback)(char*), bool usessl, uint16_t timeout) {
+/** Send an http(s) request and read the response into buf (of bufsize bytes, plus one for the terminating 0) */
+static int8_t http_request(const char* server, uint16_t port, const char* p, void(*callback)(char*), bool usessl, uint16_t timeout, char *buf, uint16_t bufsize) {
 
 	if(server == NULL || server[0]==0 || port==0 ) { // sanity checking
 		DEBUG_PRINTLN("server:port is invalid!");
@@ -2011,13 +2395,13 @@ int8_t OpenSprinkler::send_http_request(const char* server, uint16_t port, char*
 #endif
 
 	uint16_t len = strlen(p);
-	if(len > ETHER_BUFFER_SIZE) len = ETHER_BUFFER_SIZE;
+	if(len > bufsize) len = bufsize;
 	if(client->connected()) {
 		client->write((uint8_t *)p, len);
 	} else {
 		DEBUG_PRINTLN(F("client no longer connected"));
 	}
-	memset(ether_buffer, 0, ETHER_BUFFER_SIZE);
+	memset(buf, 0, bufsize);
 	uint32_t stoptime = millis()+timeout;
 
 	int pos = 0;
@@ -2028,8 +2412,8 @@ int8_t OpenSprinkler::send_http_request(const char* server, uint16_t port, char*
 	while(true) {
 		int nbytes = client->available();
 		if(nbytes>0) {
-			if(pos+nbytes>ETHER_BUFFER_SIZE) nbytes=ETHER_BUFFER_SIZE-pos; // cannot read more than buffer size
-			client->read((uint8_t*)ether_buffer+pos, nbytes);
+			if(pos+nbytes>bufsize) nbytes=bufsize-pos; // cannot read more than buffer size
+			client->read((uint8_t*)buf+pos, nbytes);
 			pos+=nbytes;
 		}
 		if((long)(millis()-stoptime)>0) { // overflow proof
@@ -2043,18 +2427,22 @@ int8_t OpenSprinkler::send_http_request(const char* server, uint16_t port, char*
 		}
 	}
 #else
-	len = client->read((uint8_t *)ether_buffer+pos, ETHER_BUFFER_SIZE);
+	len = client->read((uint8_t *)buf+pos, bufsize);
 	pos += len;
 
 #endif
-	ether_buffer[pos]=0; // properly end buffer with 0
+	buf[pos]=0; // properly end buffer with 0
 	client->stop();
 	delete client;
-	if(strlen(ether_buffer)==0) return HTTP_RQT_EMPTY_RETURN;
-	if(callback) callback(ether_buffer);
+	if(strlen(buf)==0) return HTTP_RQT_EMPTY_RETURN;
+	if(callback) callback(buf);
 	return HTTP_RQT_SUCCESS;
 }
 
+int8_t OpenSprinkler::send_http_request(const char* server, uint16_t port, char* p, void(*callback)(char*), bool usessl, uint16_t timeout) {
+	return http_request(server, port, p, callback, usessl, timeout, ether_buffer, ETHER_BUFFER_SIZE);
+}
+
 int8_t OpenSprinkler::send_http_request(uint32_t ip4, uint16_t port, char* p, void(*callback)(char*), bool usessl, uint16_t timeout) {
 	char server[20];
 	unsigned char ip[4];
@@ -2072,26 +2460,14 @@ int8_t OpenSprinkler::send_http_request(char* server_with_port, char* p, void(*c
 	return send_http_request(server, (port==NULL)?80:atoi(port), p, callback, usessl, timeout);
 }
 
-/** Switch remote IP station
- * This function takes a remote station code,
- * parses it into remote IP, port, station index,
- * and makes a HTTP GET request.
+/** Switch remote station
+ * This function takes a decoded remote IP or OTC station
+ * and makes a HTTP(S) GET request to the remote controller
+ * (directly by IP, or forwarded through OTC with the token).
  * The remote controller is assumed to have the same
  * password as the main controller
  */
-void OpenSprinkler::switch_remotestation(RemoteIPStationData *data, bool turnon, uint16_t dur) {
-	RemoteIPStationData copy;
-	memcpy((char*)&copy, (char*)data, sizeof(RemoteIPStationData));
-
-	uint32_t ip4 = hex2ulong(copy.ip, sizeof(copy.ip));
-	uint16_t port = (uint16_t)hex2ulong(copy.port, sizeof(copy.port));
-
-	unsigned char ip[4];
-	ip[0] = ip4>>24;
-	ip[1] = (ip4>>16)&0xff;
-	ip[2] = (ip4>>8)&0xff;
-	ip[3] = ip4&0xff;
-
+void OpenSprinkler::switch_remotestation(const SpecialStation *spe, bool turnon, uint16_t dur, sid_t sid) {
 	char *p = tmp_buffer;
 	BufferFiller bf = BufferFiller(p, TMP_BUFFER_SIZE*2);
 	// if turning on the zone and duration is defined, give duration as the timer value
@@ -2103,84 +2479,501 @@ void OpenSprinkler::switch_remotestation(RemoteIPStationData *data, bool turnon,
 		if(dur>0) {
 			timer = dur;
 		} else {
-			timer = iopts[IOPT_SPE_AUTO_REFRESH]?4*MAX_NUM_STATIONS:64800;
+			timer = iopts[IOPT_SPE_AUTO_REFRESH]?spe_refresh_timer():64800;
 		}
 	}
+
+	if(spe->type==STN_TYPE_REMOTE_OTC) {
+		if(!spe->text) return;
+		bf.emit_p(PSTR("GET /forward/v1/$S/cm?pw=$O&sid=$D&en=$D&t=$D"),
+							spe->text,
+							SOPT_PASSWORD,
+							(int)spe->rsid,
+							turnon, timer);
+		bf.emit_p(PSTR(" HTTP/1.0\r\nHOST: $S\r\n" STATION_REQUEST_CONNECTION), DEFAULT_OTC_SERVER_APP);
+
+		bf.emit_p(PSTR("User-Agent: $S\r\n\r\n"), user_agent_string);
+
+		send_station_request(sid, DEFAULT_OTC_SERVER_APP, DEFAULT_OTC_PORT_APP, p, true);
+		return;
+	}
+
+	unsigned char ip[4];
+	ip[0] = spe->ip4>>24;
+	ip[1] = (spe->ip4>>16)&0xff;
+	ip[2] = (spe->ip4>>8)&0xff;
+	ip[3] = spe->ip4&0xff;
+
 	bf.emit_p(PSTR("GET /cm?pw=$O&sid=$D&en=$D&t=$D"),
 						SOPT_PASSWORD,
-						(int)hex2ulong(copy.sid, sizeof(copy.sid)),
+						(int)spe->rsid,
 						turnon, timer);
-	bf.emit_p(PSTR(" HTTP/1.0\r\nHOST: $D.$D.$D.$D\r\n"),
+	bf.emit_p(PSTR(" HTTP/1.0\r\nHOST: $D.$D.$D.$D\r\n" STATION_REQUEST_CONNECTION),
 						ip[0],ip[1],ip[2],ip[3]);
 
 	bf.emit_p(PSTR("User-Agent: $S\r\n\r\n"), user_agent_string);
 
 	char server[20];
 	snprintf(server, 20, "%d.%d.%d.%d", ip[0], ip[1], ip[2], ip[3]);
-	send_http_request(server, port, p, default_http_callback);
+	RemoteSwitch rs;
+	rs.ip4 = spe->ip4;
+	rs.port = spe->port;
+	rs.sid = spe->rsid;
+	rs.en = turnon;
+	rs.timer = timer;
+	send_station_request(sid, server, spe->port, p, false, &rs);
 }
 
-/** Switch remote OTC station
- * This function takes a remote station code,
- * parses it into OTC token and station index,
- * and makes a HTTPS GET request.
- * The remote controller is assumed to have the same
- * password as the main controller
+/** Switch http(s) station
+ * This function takes a decoded http(s) station
+ * (server, port and the on/off commands) and makes a HTTP(S) GET request.
  */
-void OpenSprinkler::switch_remotestation(RemoteOTCStationData *data, bool turnon, uint16_t dur) {
-	RemoteOTCStationData copy;
-	memcpy((char*)&copy, (char*)data, sizeof(RemoteOTCStationData));
-	copy.token[sizeof(copy.token)-1] = 0; // ensure the string ends properly
+void OpenSprinkler::switch_httpstation(const SpecialStation *spe, bool turnon, bool usessl, sid_t sid) {
+	const char *cmd = turnon ? spe->on_cmd : spe->off_cmd;
+
 	char *p = tmp_buffer;
 	BufferFiller bf = BufferFiller(p, TMP_BUFFER_SIZE*2);
-	// if turning on the zone and duration is defined, give duration as the timer value
-	// otherwise:
-	//   if autorefresh is defined, we give a fixed duration each time, and auto refresh will renew it periodically
-	//   if no auto refresh, we will give the maximum allowed duration, and station will be turned off when off command is sent
-	uint16_t timer = 0;
-	if(turnon) {
-		if(dur>0) {
-			timer = dur;
+
+	if(cmd==NULL || spe->server==NULL) return; // proceed only if cmd and server are valid
+
+	bf.emit_p(PSTR("GET /$S HTTP/1.0\r\nHOST: $S\r\n" STATION_REQUEST_CONNECTION), cmd, spe->server);
+	bf.emit_p(PSTR("User-Agent: $S\r\n\r\n"), user_agent_string);
+
+	send_station_request(sid, spe->server, spe->port, p, usessl);
+}
+
+#if !defined(ARDUINO)
+/** Special station dispatch (RPI/LINUX)
+ * Remote and HTTP(S) station requests are sent by a small pool of worker threads,
+ * so that slow or unreachable hosts don't hold up the main loop. Each station
+ * keeps only its latest request: a newer command replaces one that hasn't been
+ * picked up yet, and requests to the same station are never sent concurrently.
+ * Failed requests go back to the main loop, which retries them unless a newer
+ * command for the station has come in since.
+ * Remote IP station requests are held (no worker may take them) until the end of
+ * apply_all_station_bits, and the ones for the same controller are then sent as
+ * one /cm?m= request. A worker is woken per batch: the one that takes a batch
+ * wakes the next if more requests are waiting.
+ */
+#include <pthread.h>
+
+struct SpecialRequest {
+	char *server;
+	char *p;
+	uint16_t port;
+	bool usessl;
+	unsigned char retries;
+	bool held;        // waiting for release_special_requests: not to be taken by a worker yet
+	RemoteSwitch rs;  // remote IP station switch (rs.ip4 is 0 for other station types)
+};
+
+static pthread_mutex_t spe_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t spe_work = PTHREAD_COND_INITIALIZER;  // a request can be taken (signalled, to wake one worker)
+static pthread_cond_t spe_done = PTHREAD_COND_INITIALIZER;  // a request has been sent
+static SpecialRequest *spe_failed[SPECIAL_RESULT_SIZE];   // failed requests, for the main loop
+static sid_t spe_failed_sids[SPECIAL_RESULT_SIZE];
+static unsigned char spe_nfailed = 0;
+static SpecialRequest *spe_pending[MAX_NUM_STATIONS];  // latest request of each station, not yet picked up
+static bool spe_busy[MAX_NUM_STATIONS];                // a worker is sending a request for this station
+static sid_t spe_order[MAX_NUM_STATIONS];              // stations with a pending request, oldest first
+static sid_t spe_norder = 0;
+static unsigned char spe_nactive = 0;
+static bool spe_started = false;
+static bool spe_held = false;  // some pending requests are held
+static struct { uint32_t ip4; uint16_t port; } spe_nobatch[SPECIAL_NOBATCH_SIZE]; // controllers that can't take m=
+static unsigned char spe_nnobatch = 0;
+
+/** Connection pool for station requests
+ * Station requests ask for keep-alive. If the server agrees (and says how long
+ * the response is), the connection is kept here for the next request to the
+ * same server, which saves the TCP and, for https/OTC, the TLS handshake.
+ */
+struct PooledConnection {
+	EthernetClient *client;
+	char server[64];
+	uint16_t port;
+	bool usessl;
+	ulong last_used;
+};
+
+static PooledConnection http_pool[HTTP_POOL_SIZE];
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void close_connection(EthernetClient *client) {
+	client->stop();
+	delete client;
+}
+
+/** Take an idle connection to server:port out of the pool (NULL if there is none) */
+static EthernetClient *pool_take(const char *server, uint16_t port, bool usessl) {
+	EthernetClient *client = NULL;
+	ulong now = millis();
+	pthread_mutex_lock(&pool_lock);
+	for(unsigned char i=0;i<HTTP_POOL_SIZE;i++) {
+		PooledConnection *c = http_pool+i;
+		if(!c->client) continue;
+		if(now-c->last_used>HTTP_POOL_IDLE) {
+			close_connection(c->client);
+			c->client = NULL;
+		} else if(!client && c->port==port && c->usessl==usessl && !strcmp(c->server, server)) {
+			client = c->client;
+			c->client = NULL;
+		}
+	}
+	pthread_mutex_unlock(&pool_lock);
+	return client;
+}
+
+/** Return a connection to the pool, replacing the least recently used one if it's full */
+static void pool_put(EthernetClient *client, const char *server, uint16_t port, bool usessl) {
+	if(strlen(server)>=sizeof(http_pool[0].server)) {
+		close_connection(client);
+		return;
+	}
+	pthread_mutex_lock(&pool_lock);
+	PooledConnection *slot = http_pool;
+	for(unsigned char i=0;i<HTTP_POOL_SIZE;i++) {
+		PooledConnection *c = http_pool+i;
+		if(!c->client) { slot = c; break; }
+		if(c->last_used-slot->last_used>(ulong)LONG_MAX) slot = c; // older than the current pick
+	}
+	if(slot->client) close_connection(slot->client);
+	slot->client = client;
+	strcpy(slot->server, server);
+	slot->port = port;
+	slot->usessl = usessl;
+	slot->last_used = millis();
+	pthread_mutex_unlock(&pool_lock);
+}
+
+/** Find the content length and keep-alive header in the response headers (buf up to hdr_end) */
+static long http_response_info(const char *buf, const char *hdr_end, bool *keepalive) {
+	long clen = -1;
+	*keepalive = false;
+	for(const char *l=strstr(buf, "\r\n"); l && l<hdr_end; l=strstr(l+2, "\r\n")) {
+		const char *h = l+2;
+		if(!strncasecmp(h, "Content-Length:", 15)) {
+			clen = atol(h+15);
+		} else if(!strncasecmp(h, "Connection:", 11)) {
+			h += 11;
+			while(*h==' ') h++;
+			*keepalive = !strncasecmp(h, "keep-alive", 10);
+		}
+	}
+	return clen;
+}
+
+/** Send a station request over a pooled connection, or a new one, and read the response into buf
+ * A pooled connection the server has closed in the meantime is retried on a new connection.
+ * Without a Content-Length the response ends with the first read, and the connection is closed
+ */
+static int8_t station_http_request(const char* server, uint16_t port, const char* p, bool usessl, char *buf, uint16_t bufsize) {
+	if(server == NULL || server[0]==0 || port==0 ) { // sanity checking
+		DEBUG_PRINTLN("server:port is invalid!");
+		return HTTP_RQT_CONNECT_ERR;
+	}
+	uint16_t len = strlen(p);
+	if(len > bufsize) len = bufsize;
+	for(unsigned char attempt=0;attempt<2;attempt++) {
+		EthernetClient *client = attempt ? NULL : pool_take(server, port, usessl);
+		bool reused = (client!=NULL);
+		if(!client) {
+			if(usessl) client = new EthernetClientSsl();
+			else client = new EthernetClient();
+			if(!client->connect(server, port)) {
+				DEBUG_PRINTLN(F("failed."));
+				close_connection(client);
+				return HTTP_RQT_CONNECT_ERR;
+			}
+		}
+
+		int pos = 0;
+		char *body = NULL;
+		long clen = -1;
+		bool keepalive = false;
+		if(client->write((uint8_t *)p, len)==len) {
+			ulong stoptime = millis()+5000;
+			while(pos<bufsize) {
+				int n = client->read((uint8_t *)buf+pos, bufsize-pos);
+				if(n<=0) break;
+				pos += n;
+				buf[pos] = 0;
+				if(!body) {
+					char *e = strstr(buf, "\r\n\r\n");
+					if(e) {
+						body = e+4;
+						clen = http_response_info(buf, e, &keepalive);
+					}
+				}
+				if(!body || clen<0) break; // no Content-Length (in the first read): take what came, as a single read did
+				if(buf+pos-body>=clen) break; // got the whole response
+				if((long)(millis()-stoptime)>0) break;
+			}
+		}
+		buf[pos] = 0;
+		if(pos==0 && reused) { // the server has dropped the idle connection
+			close_connection(client);
+			continue;
+		}
+		if(body && keepalive && clen>=0 && buf+pos-body==clen) {
+			pool_put(client, server, port, usessl);
 		} else {
-			timer = iopts[IOPT_SPE_AUTO_REFRESH]?4*MAX_NUM_STATIONS:64800;
+			close_connection(client);
 		}
+		if(pos==0) return HTTP_RQT_EMPTY_RETURN;
+		default_http_callback(buf);
+		return HTTP_RQT_SUCCESS;
 	}
-	bf.emit_p(PSTR("GET /forward/v1/$S/cm?pw=$O&sid=$D&en=$D&t=$D"),
-						copy.token,
-						SOPT_PASSWORD,
-						(int)hex2ulong(copy.sid, sizeof(copy.sid)),
-						turnon, timer);
-	bf.emit_p(PSTR(" HTTP/1.0\r\nHOST: $S\r\nConnection:close\r\n"), DEFAULT_OTC_SERVER_APP);
+	return HTTP_RQT_CONNECT_ERR;
+}
 
-	bf.emit_p(PSTR("User-Agent: $S\r\n\r\n"), user_agent_string);
+static void free_special_request(SpecialRequest *r) {
+	free(r->server);
+	free(r->p);
+	free(r);
+}
 
-	send_http_request(DEFAULT_OTC_SERVER_APP, DEFAULT_OTC_PORT_APP, p, default_http_callback, true);
+/** Put a request back in the queue, unless the station has a newer one (call with spe_lock held) */
+static void special_requeue(sid_t sid, SpecialRequest *r) {
+	if(spe_pending[sid] || spe_busy[sid]) {
+		free_special_request(r);
+	} else {
+		r->held = false;
+		spe_pending[sid] = r;
+		spe_order[spe_norder++] = sid;
+	}
 }
 
-/** Switch http(s) station
- * This function takes an http(s) station code,
- * parses it into a server name and two HTTP GET requests.
+/** A worker may take the pending request of the station (call with spe_lock held) */
+static bool special_claimable(sid_t sid) {
+	return !spe_busy[sid] && !spe_pending[sid]->held;
+}
+
+/** Make the held requests claimable and wake a worker for them (call with spe_lock held) */
+static void special_release() {
+	if(!spe_held) return;
+	for(sid_t i=0;i<spe_norder;i++) spe_pending[spe_order[i]]->held = false;
+	spe_held = false;
+	pthread_cond_signal(&spe_work);
+}
+
+static bool special_nobatch(const RemoteSwitch *rs) {
+	for(unsigned char i=0;i<spe_nnobatch;i++) {
+		if(spe_nobatch[i].ip4==rs->ip4 && spe_nobatch[i].port==rs->port) return true;
+	}
+	return false;
+}
+
+/** Build a /cm request that switches all stations of a batch
+ * The first request gives the password and headers, its sid/en/t are replaced by m=sid:en:t,...
  */
-void OpenSprinkler::switch_httpstation(HTTPStationData *data, bool turnon, bool usessl) {
+static char *special_batch_request(SpecialRequest **reqs, unsigned char n) {
+	const char *p = reqs[0]->p;
+	const char *q = strstr(p, "&sid=");
+	const char *h = strstr(p, " HTTP/");
+	if(!q || !h) return NULL;
+	char *batch = (char *)malloc(strlen(p)+n*16+4);
+	if(!batch) return NULL;
+	int len = q-p;
+	memcpy(batch, p, len);
+	len += sprintf(batch+len, "&m=");
+	for(unsigned char i=0;i<n;i++) {
+		const RemoteSwitch *rs = &reqs[i]->rs;
+		len += sprintf(batch+len, "%s%u:%u:%u", i?",":"", rs->sid, rs->en, rs->timer);
+	}
+	strcpy(batch+len, h);
+	return batch;
+}
+
+static void *special_worker(void *) {
+	char *buf = (char *)malloc(ETHER_BUFFER_SIZE+1); // each worker reads responses into its own buffer
+	SpecialRequest *reqs[SPECIAL_BATCH_SIZE];
+	sid_t sids[SPECIAL_BATCH_SIZE];
+	pthread_mutex_lock(&spe_lock);
+	while(true) {
+		sid_t i;
+		for(i=0;i<spe_norder && !special_claimable(spe_order[i]);i++) ;
+		if(i==spe_norder) {
+			pthread_cond_wait(&spe_work, &spe_lock);
+			continue;
+		}
+		// take the oldest request, and the other requests to the same remote controller with it
+		unsigned char n = 0;
+		const RemoteSwitch *rs = &spe_pending[spe_order[i]]->rs;
+		bool batch = rs->ip4 && !special_nobatch(rs);
+		uint32_t ip4 = rs->ip4;
+		uint16_t port = rs->port;
+		while(i<spe_norder && n<SPECIAL_BATCH_SIZE) {
+			sid_t sid = spe_order[i];
+			SpecialRequest *r = spe_pending[sid];
+			if(n==0 || (special_claimable(sid) && r->rs.ip4==ip4 && r->rs.port==port)) {
+				memmove(spe_order+i, spe_order+i+1, (spe_norder-i-1)*sizeof(sid_t));
+				spe_norder--;
+				spe_pending[sid] = NULL;
+				spe_busy[sid] = true;
+				reqs[n] = r;
+				sids[n] = sid;
+				n++;
+				if(!batch) break;
+			} else {
+				i++;
+			}
+		}
+		spe_nactive++;
+		for(i=0;i<spe_norder && !special_claimable(spe_order[i]);i++) ;
+		if(i<spe_norder) pthread_cond_signal(&spe_work); // another worker for the next batch
+		pthread_mutex_unlock(&spe_lock);
+
+		int8_t code = HTTP_RQT_NOT_RECEIVED;
+		bool unsupported = false;
+		if(n>1) {
+			char *p = special_batch_request(reqs, n);
+			if(buf && p) {
+				code = station_http_request(reqs[0]->server, reqs[0]->port, p, false, buf, ETHER_BUFFER_SIZE);
+				const char *res = strstr(buf, "\"result\":");
+				if(code==HTTP_RQT_SUCCESS && res && atoi(res+9)==16) { // controllers that predate m= answer 'data missing'
+					code = HTTP_RQT_NOT_RECEIVED;
+					unsupported = true;
+				}
+			}
+			free(p);
+		} else if(buf) {
+			code = station_http_request(reqs[0]->server, reqs[0]->port, reqs[0]->p, reqs[0]->usessl, buf, ETHER_BUFFER_SIZE);
+		}
 
-	HTTPStationData copy;
-	// make a copy of the HTTP station data and work with it
-	memcpy((char*)&copy, (char*)data, sizeof(HTTPStationData));
-	char * server = strtok((char *)copy.data, ",");
-	char * port = strtok(NULL, ",");
-	char * on_cmd = strtok(NULL, ",");
-	char * off_cmd = strtok(NULL, ",");
-	char * cmd = turnon ? on_cmd : off_cmd;
+		pthread_mutex_lock(&spe_lock);
+		spe_nactive--;
+		for(unsigned char k=0;k<n;k++) spe_busy[sids[k]] = false;
+		if(unsupported && spe_nnobatch<SPECIAL_NOBATCH_SIZE) {
+			spe_nobatch[spe_nnobatch].ip4 = ip4;
+			spe_nobatch[spe_nnobatch].port = port;
+			spe_nnobatch++;
+		}
+		for(unsigned char k=0;k<n;k++) {
+			if(unsupported) {
+				special_requeue(sids[k], reqs[k]); // send them one by one
+			} else if(code!=HTTP_RQT_SUCCESS && spe_nfailed<SPECIAL_RESULT_SIZE) {
+				spe_failed[spe_nfailed] = reqs[k];
+				spe_failed_sids[spe_nfailed] = sids[k];
+				spe_nfailed++;
+			} else {
+				free_special_request(reqs[k]);
+			}
+		}
+		pthread_cond_broadcast(&spe_done); // this worker then goes on with the requests still waiting
+	}
+	return NULL;
+}
 
-	char *p = tmp_buffer;
-	BufferFiller bf = BufferFiller(p, TMP_BUFFER_SIZE*2);
+/** Queue a request for the dispatch workers, returns false if it has to be sent directly
+ * Remote IP station requests (rs!=NULL) wait for release_special_requests,
+ * so that the ones switched in the same tick can go out together
+ */
+static bool special_dispatch(sid_t sid, const char *server, uint16_t port, const char *p, bool usessl, const RemoteSwitch *rs) {
+	if(!spe_started) {
+		pthread_t t;
+		for(unsigned char i=0;i<SPECIAL_WORKERS;i++) {
+			if(pthread_create(&t, NULL, special_worker, NULL)==0) {
+				pthread_detach(t);
+				spe_started = true;
+			}
+		}
+		if(!spe_started) return false;
+	}
+	SpecialRequest *r = (SpecialRequest *)malloc(sizeof(SpecialRequest));
+	if(!r) return false;
+	r->server = strdup(server);
+	r->p = strdup(p);
+	r->port = port;
+	r->usessl = usessl;
+	r->retries = 0;
+	r->held = (rs!=NULL);
+	if(rs) r->rs = *rs;
+	else memset(&r->rs, 0, sizeof(RemoteSwitch));
+	if(!r->server || !r->p) {
+		free_special_request(r);
+		return false;
+	}
+
+	pthread_mutex_lock(&spe_lock);
+	if(spe_pending[sid]) {
+		free_special_request(spe_pending[sid]); // stale: replaced by the newer command
+	} else {
+		spe_order[spe_norder++] = sid;
+	}
+	spe_pending[sid] = r;
+	if(rs) spe_held = true;
+	else pthread_cond_signal(&spe_work);
+	pthread_mutex_unlock(&spe_lock);
+	return true;
+}
 
-	if(cmd==NULL || server==NULL) return; // proceed only if cmd and server are valid
+/** Let the workers send the requests held back for batching */
+void OpenSprinkler::release_special_requests() {
+	if(!spe_started) return;
+	pthread_mutex_lock(&spe_lock);
+	special_release();
+	pthread_mutex_unlock(&spe_lock);
+}
 
-	bf.emit_p(PSTR("GET /$S HTTP/1.0\r\nHOST: $S\r\n"), cmd, server);
-	bf.emit_p(PSTR("User-Agent: $S\r\n\r\n"), user_agent_string);
+/** Retry the special station requests that failed since the last call,
+ * unless the station has been given a newer command in the meantime
+ */
+void OpenSprinkler::process_special_results() {
+	if(!spe_started) return;
+	pthread_mutex_lock(&spe_lock);
+	for(unsigned char i=0;i<spe_nfailed;i++) {
+		SpecialRequest *r = spe_failed[i];
+		sid_t sid = spe_failed_sids[i];
+		DEBUG_PRINT("failed to switch special station ");
+		DEBUG_PRINTLN(sid+1);
+		if(r->retries<SPECIAL_RETRIES) {
+			r->retries++;
+			special_requeue(sid, r);
+		} else {
+			free_special_request(r);
+		}
+	}
+	if(spe_nfailed) pthread_cond_signal(&spe_work);
+	spe_nfailed = 0;
+	special_release();
+	pthread_mutex_unlock(&spe_lock);
+}
 
-	send_http_request(server, atoi(port), p, default_http_callback, usessl);
+void OpenSprinkler::flush_special_requests(ulong timeout_ms) {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += timeout_ms/1000;
+	ts.tv_nsec += (timeout_ms%1000)*1000000L;
+	if(ts.tv_nsec>=1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+	pthread_mutex_lock(&rf_lock);
+	while(rf_count || rf_sending) {
+		if(pthread_cond_timedwait(&rf_cond, &rf_lock, &ts)) break;
+	}
+	pthread_mutex_unlock(&rf_lock);
+	if(!spe_started) return;
+	pthread_mutex_lock(&spe_lock);
+	special_release();
+	while(spe_norder || spe_nactive) {
+		if(pthread_cond_timedwait(&spe_done, &spe_lock, &ts)) break;
+	}
+	pthread_mutex_unlock(&spe_lock);
+}
+#endif
+
+/** Send the request that switches a special station
+ * On RPI/LINUX it goes to the dispatch workers, unless sid is SID_NONE
+ */
+void OpenSprinkler::send_station_request(sid_t sid, const char *server, uint16_t port, char *p, bool usessl, const RemoteSwitch *rs) {
+#if !defined(ARDUINO)
+	if(sid!=SID_NONE && special_dispatch(sid, server, port, p, usessl, rs)) return;
+	station_http_request(server, port, p, usessl, ether_buffer, ETHER_BUFFER_SIZE);
+#else
+	send_http_request(server, port, p, default_http_callback, usessl);
+#endif
 }
 
 /** Prepare factory reset */
@@ -2234,14 +3027,21 @@ void OpenSprinkler::factory_reset() {
 		if(i<99) {
 			pdata->name[1]='0'+(sid/10); // default station name
 			pdata->name[2]='0'+(sid%10);
-		} else {
+		} else if(i<999) {
 			pdata->name[1]='0'+(sid/100);
 			pdata->name[2]='0'+((sid%100)/10);
 			pdata->name[3]='0'+(sid%10);
+		} else {
+			pdata->name[1]='0'+(sid/1000);
+			pdata->name[2]='0'+((sid%1000)/100);
+			pdata->name[3]='0'+((sid%100)/10);
+			pdata->name[4]='0'+(sid%10);
+			pdata->name[5]=0;
 		}
 		file_write_block(STATIONS_FILENAME, pdata, sizeof(StationData)*i, sizeof(StationData));
 	}
 
+	name_order_n = 0; // names were written directly
 	attribs_load(); // load and repackage attrib bits (for backward compatibility)
 
 	// 3. write non-volatile controller status
@@ -2249,8 +3049,11 @@ void OpenSprinkler::factory_reset() {
 	nvdata_save();
 	last_reboot_cause = nvdata.reboot_cause;
 
-	// 4. write program data: just need to write a program counter: 0
-	file_write_byte(PROG_FILENAME, 0, 0);
+	// 4. write program data: just need to write an empty program file header
+	pd.eraseall();
+#if !defined(ARDUINO)
+	remove_file(QUEUE_FILENAME);
+#endif
 
 	// 5. write 'done' file
 	file_write_byte(DONE_FILENAME, 0, 1);
@@ -2455,6 +3258,13 @@ void OpenSprinkler::iopts_load() {
 	file_read_block(IOPTS_FILENAME, iopts, 0, NUM_IOPTS);
 	nboards = iopts[IOPT_EXT_BOARDS]+1;
 	nstations = nboards * 8;
+#if defined(LARGE_INSTALL)
+	sid_t n = pd.resize_tables(nstations);
+	if (n < nstations) { // out of memory: run only the boards the scheduler has room for
+		nboards = n / 8;
+		nstations = nboards * 8;
+	}
+#endif
 	status.enabled = iopts[IOPT_DEVICE_ENABLE];
 	iopts[IOPT_FW_VERSION] = OS_FW_VERSION;
 	iopts[IOPT_FW_MINOR] = OS_FW_MINOR;
@@ -2488,6 +3298,10 @@ void OpenSprinkler::populate_master() {
 
 /** Save integer options to file */
 void OpenSprinkler::iopts_save() {
+#if defined(LARGE_INSTALL)
+	// out of memory for more boards: keep the current ones
+	if (pd.resize_tables((iopts[IOPT_EXT_BOARDS]+1)*8) < (iopts[IOPT_EXT_BOARDS]+1)*8) iopts[IOPT_EXT_BOARDS] = nboards-1;
+#endif
 	file_write_block(IOPTS_FILENAME, iopts, 0, NUM_IOPTS);
 	nboards = iopts[IOPT_EXT_BOARDS]+1;
 	nstations = nboards * 8;
@@ -2715,7 +3529,7 @@ void OpenSprinkler::lcd_print_screen(char c) {
 	} else {
 		unsigned char bitvalue = station_bits[status.display_board];
 		for (unsigned char s=0; s<8; s++) {
-			unsigned char sid = (unsigned char)status.display_board<<3;
+			sid_t sid = (unsigned char)status.display_board<<3;
 			sid += (s+1);
 			if (sid == iopts[IOPT_MASTER_STATION]) {
 				lcd.print((bitvalue&1) ? c : 'M'); // print master station
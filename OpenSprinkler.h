@@ -144,9 +144,11 @@ struct StationAttrib {  // station attributes
 	unsigned char igpu:1; // todo: ignore pause
 
 	unsigned char gid;    // sequential group id
-	unsigned char reserved[2]; // reserved bytes for the future
+	uint16_t flow;        // nominal flow rate x100 (STATION_FLOW_FIXED is set if entered by hand rather than learned)
 }; // total is 4 bytes so far
 
+#define STATION_FLOW_FIXED 0x8000
+
 /** Station data structure */
 struct StationData {
 	char name[STATION_NAME_SIZE];
@@ -186,6 +188,15 @@ struct RemoteIPStationData {
 	unsigned char sid[2];
 };
 
+/** Remote IP station switch, so that the ones for the same controller can be sent together */
+struct RemoteSwitch {
+	uint32_t ip4;
+	uint16_t port;
+	uint16_t sid;     // station index on the remote controller
+	unsigned char en;
+	uint16_t timer;
+};
+
 /** Remote OTC station data structures - Must fit in STATION_SPECIAL_DATA_SIZE */
 struct RemoteOTCStationData {
 	unsigned char token[DEFAULT_OTC_TOKEN_LENGTH+1];
@@ -203,6 +214,21 @@ struct HTTPStationData {
 	unsigned char data[STATION_SPECIAL_DATA_SIZE];
 };
 
+/** Decoded special station data, kept in memory so that switching reads no file and parses nothing */
+struct SpecialStation {
+	unsigned char type;
+	RFStationCode rf;      // RF (rf.timing is 0 if the code is invalid)
+	uint32_t ip4;          // remote IP
+	uint16_t port;         // remote IP, HTTP(S)
+	uint16_t rsid;         // station index on the remote IP / OTC controller
+	unsigned char pin;     // GPIO
+	unsigned char active;
+	char *text;            // OTC token, or the HTTP(S) fields separated by 0s
+	char *server;          // HTTP(S) fields, pointing into text
+	char *on_cmd;
+	char *off_cmd;
+};
+
 /** Volatile controller status bits */
 struct ConStatus {
 	unsigned char enabled:1;         // operation enable (when set, controller operation is enabled)
@@ -255,7 +281,8 @@ public:
 	static NVConData nvdata;
 	static ConStatus status;
 	static ConStatus old_status;
-	static unsigned char nboards, nstations;
+	static unsigned char nboards;
+	static sid_t nstations;
 	static unsigned char hw_type;  // hardware type
 	static unsigned char hw_rev;   // hardware minor
 
@@ -272,6 +299,8 @@ public:
 	static unsigned char attrib_dis[];
 	static unsigned char attrib_spe[];
 	static unsigned char attrib_grp[];
+	static uint16_t attrib_flow[];
+	static unsigned char attrib_curr[]; // learned steady-state current in 10 mA (not saved, re-learned after reboot)
 	static unsigned char masters[NUM_MASTER_ZONES][NUM_MASTER_OPTS];
 	static time_os_t masters_last_on[NUM_MASTER_ZONES];
 
@@ -304,32 +333,39 @@ public:
 	static bool load_hardware_mac(unsigned char* buffer, bool wired=false);  // read hardware mac address
 	static time_os_t now_tz();
 	// -- station names and attributes
-	static void get_station_data(unsigned char sid, StationData* data); // get station data
-	static void set_station_data(unsigned char sid, StationData* data); // set station data
-	static void get_station_name(unsigned char sid, char buf[]); // get station name
-	static void set_station_name(unsigned char sid, char buf[]); // set station name
-	static unsigned char get_station_type(unsigned char sid); // get station type
-	static unsigned char is_sequential_station(unsigned char sid);
-	static unsigned char is_master_station(unsigned char sid);
-	static unsigned char bound_to_master(unsigned char sid, unsigned char mas);
+	static void get_station_data(sid_t sid, StationData* data); // get station data
+	static void set_station_data(sid_t sid, StationData* data); // set station data
+	static void get_station_name(sid_t sid, char buf[]); // get station name
+	static void set_station_name(sid_t sid, char buf[]); // set station name
+	static const sid_t* get_name_order(); // the nstations station ids sorted by name, built at first use
+	static unsigned char get_station_type(sid_t sid); // get station type
+	static unsigned char is_sequential_station(sid_t sid);
+	static unsigned char is_master_station(sid_t sid);
+	static unsigned char bound_to_master(sid_t sid, unsigned char mas);
 	static unsigned char get_master_id(unsigned char mas);
 	static int16_t get_on_adj(unsigned char mas);
 	static int16_t get_off_adj(unsigned char mas);
 	static int16_t get_imin();
 	static int16_t get_imax();
-	static unsigned char is_running(unsigned char sid);
-	static unsigned char get_station_gid(unsigned char sid);
-	static void set_station_gid(unsigned char sid, unsigned char gid);
-
-	//static StationAttrib get_station_attrib(unsigned char sid); // get station attribute
+	static unsigned char is_running(sid_t sid);
+	static unsigned char get_station_gid(sid_t sid);
+	static unsigned char get_num_seq_groups(); // number of sequential groups in use (1 to MAX_SEQ_GROUPS)
+	static void set_station_gid(sid_t sid, unsigned char gid);
+	static uint16_t get_station_flow(sid_t sid); // nominal flow rate x100, 0 if unknown
+	static void learn_station_flow(sid_t sid, uint16_t flow); // update the learned flow rate from a measurement
+	static uint32_t get_master_capacity(unsigned char mas); // flow capacity x100, 0 if unlimited
+	static uint16_t get_station_current(sid_t sid); // steady-state current in mA, 0 if unknown
+	static void learn_station_current(sid_t sid, uint16_t current); // update the learned current from a measurement
+	static uint16_t get_current_budget(); // current in mA that running stations may draw together, 0 if unlimited
+
+	//static StationAttrib get_station_attrib(sid_t sid); // get station attribute
 	static void attribs_save(); // repackage attrib bits and save (backward compatibility)
 	static void attribs_load(); // load and repackage attrib bits (backward compatibility)
 	static bool parse_rfstation_code(RFStationData *data, RFStationCode *code); // parse rf code into on/off/time sections
-	static void switch_rfstation(RFStationData *data, bool turnon);  // switch rf station
-	static void switch_remotestation(RemoteIPStationData *data, bool turnon, uint16_t dur=0); // switch remote IP station
-	static void switch_remotestation(RemoteOTCStationData *data, bool turnon, uint16_t dur=0); // switch remote OTC station
-	static void switch_gpiostation(GPIOStationData *data, bool turnon); // switch gpio station
-	static void switch_httpstation(HTTPStationData *data, bool turnon, bool usessl=false); // switch http station
+	static void switch_rfstation(const SpecialStation *spe, bool turnon);  // switch rf station
+	static void switch_remotestation(const SpecialStation *spe, bool turnon, uint16_t dur=0, sid_t sid=SID_NONE); // switch remote IP or OTC station
+	static void switch_gpiostation(const SpecialStation *spe, bool turnon); // switch gpio station
+	static void switch_httpstation(const SpecialStation *spe, bool turnon, bool usessl=false, sid_t sid=SID_NONE); // switch http station
 	
 	// -- options and data storeage
 	static void nvdata_load();
@@ -361,15 +397,21 @@ public:
 	static int detect_exp();      // detect the number of expansion boards
 	static unsigned char weekday_today();  // returns index of today's weekday (Monday is 0)
 
-	static unsigned char set_station_bit(unsigned char sid, unsigned char value, uint16_t dur=0); // set station bit of one station (sid->station index, value->0/1)
-	static unsigned char get_station_bit(unsigned char sid); // get station bit of one station (sid->station index)
-	static void switch_special_station(unsigned char sid, unsigned char value, uint16_t dur=0); // swtich special station
+	static unsigned char set_station_bit(sid_t sid, unsigned char value, uint16_t dur=0); // set station bit of one station (sid->station index, value->0/1)
+	static unsigned char get_station_bit(sid_t sid); // get station bit of one station (sid->station index)
+	static void switch_special_station(sid_t sid, unsigned char value, uint16_t dur=0); // swtich special station
 	static void clear_all_station_bits(); // clear all station bits
 	static void apply_all_station_bits(void (*post_activation_callback)()=NULL); // apply all station bits (activate/deactive values)
+	static bool outputs_valid; // false forces the next apply_all_station_bits to rewrite all outputs
 
 	static int8_t send_http_request(uint32_t ip4, uint16_t port, char* p, void(*callback)(char*)=NULL, bool usessl=false, uint16_t timeout=5000);
 	static int8_t send_http_request(const char* server, uint16_t port, char* p, void(*callback)(char*)=NULL, bool usessl=false, uint16_t timeout=5000);
 	static int8_t send_http_request(char* server_with_port, char* p, void(*callback)(char*)=NULL, bool usessl=false, uint16_t timeout=5000);
+	#if !defined(ARDUINO)
+	static void process_special_results(); // collect the outcome of special station requests sent by the dispatch workers
+	static void flush_special_requests(ulong timeout_ms); // wait for queued special station requests and RF codes to be sent
+	static void release_special_requests(); // send the remote station requests held back for batching
+	#endif
 	
 	#if defined(USE_OTF)
 	static OTCConfig otc;
@@ -455,17 +497,30 @@ private:
 
 #if defined(ESP8266)
 	static void latch_boost(unsigned char volt=0);
-	static void latch_open(unsigned char sid);
-	static void latch_close(unsigned char sid);
-	static void latch_setzonepin(unsigned char sid, unsigned char value);
+	static void latch_open(sid_t sid);
+	static void latch_close(sid_t sid);
+	static void latch_setzonepin(sid_t sid, unsigned char value);
 	static void latch_setallzonepins(unsigned char value);
 	static void latch_disable_alloutputs_v2();
-	static void latch_setzoneoutput_v2(unsigned char sid, unsigned char A, unsigned char K);
+	static void latch_setzoneoutput_v2(sid_t sid, unsigned char A, unsigned char K);
 	static void latch_apply_all_station_bits();
 	static unsigned char prev_station_bits[];
 #endif // LCD functions
 	static unsigned char engage_booster;
 	static RCSwitch rfswitch;
+	static sid_t name_order[];  // station ids sorted by name (ties by index)
+	static sid_t name_order_n;  // number of stations in name_order, 0 if it has to be rebuilt
+	static void name_order_insert(sid_t sid, const char *name, sid_t n);
+	static sid_t spe_sids[];  // special station ids in order, cycled through by auto refresh
+	static sid_t nspe_sids;
+	static bool spe_sids_valid;
+	static SpecialStation *spe_data;  // decoded data of the stations in spe_sids
+	static void spe_sids_build();
+	static void spe_decode(sid_t sid, SpecialStation *spe);
+	static const SpecialStation* get_special_station(sid_t sid);
+	static uint16_t spe_refresh_timer();
+	static void write_station_outputs(bool verify);
+	static void send_station_request(sid_t sid, const char *server, uint16_t port, char *p, bool usessl, const RemoteSwitch *rs=NULL);
 
 	#if defined(USE_OTF)
 	static void parse_otc_config();
@@ -40,6 +40,32 @@
 #include "utils.h"
 #include "RCSwitch.h"
 
+#if !defined(ARDUINO)
+#include <time.h>
+
+#define RCSWITCH_SPIN_US 200  // the last part of a wait is spun rather than slept, to be on time
+
+/** Monotonic clock in microseconds */
+static uint64_t monotonic_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000ULL + ts.tv_nsec/1000;
+}
+
+/** Wait until the monotonic clock reaches t: sleep through most of it, spin the rest */
+static void wait_until_us(uint64_t t) {
+  uint64_t now = monotonic_us();
+  if (t > now + RCSWITCH_SPIN_US) {
+    struct timespec ts;
+    uint64_t wake = t - RCSWITCH_SPIN_US;
+    ts.tv_sec = wake / 1000000ULL;
+    ts.tv_nsec = (wake % 1000000ULL) * 1000;
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+  }
+  while (monotonic_us() < t);
+}
+#endif
+
 /* Format for protocol definitions:
  * {pulselength, Sync bit, "0" bit, "1" bit, invertedSignal}
  * 
@@ -151,6 +177,9 @@ void RCSwitch::send(uint32_t code, uint16_t length) {
   if (this->nTransmitterPin == -1)
     return;
 
+#if !defined(ARDUINO)
+  this->nextEdge = monotonic_us();
+#endif
   for (int nRepeat = 0; nRepeat < nRepeatTransmit; nRepeat++) {
     for (int i = length-1; i >= 0; i--) {
       if (code & (1L << i))
@@ -172,7 +201,18 @@ void RCSwitch::send(uint32_t code, uint16_t length) {
 void RCSwitch::transmit(HighLow pulses) {
   uint8_t firstLogicLevel = (this->protocol.invertedSignal) ? LOW : HIGH;
   uint8_t secondLogicLevel = (this->protocol.invertedSignal) ? HIGH : LOW;
- 
+
+#if !defined(ARDUINO)
+  // edges follow an absolute schedule, so the time spent in digitalWrite
+  // and in waking up doesn't add up over the code
+  digitalWrite(this->nTransmitterPin, firstLogicLevel);
+  this->nextEdge += (uint64_t)this->protocol.pulseLength * pulses.high;
+  wait_until_us(this->nextEdge);
+
+  digitalWrite(this->nTransmitterPin, secondLogicLevel);
+  this->nextEdge += (uint64_t)this->protocol.pulseLength * pulses.low;
+  wait_until_us(this->nextEdge);
+#else
   ulong timeout = micros() + this->protocol.pulseLength * pulses.high; 
   digitalWrite(this->nTransmitterPin, firstLogicLevel);
   while(micros() < timeout) {
@@ -184,4 +224,5 @@ void RCSwitch::transmit(HighLow pulses) {
   while(micros() < timeout) {
     delayMicroseconds(5);
   }
+#endif
 }
@@ -95,6 +95,9 @@ class RCSwitch {
 
     int nTransmitterPin;
     int nRepeatTransmit;
+#if !defined(ARDUINO)
+    uint64_t nextEdge;  // time of the next edge on the monotonic clock (in microseconds)
+#endif
     
     Protocol protocol;
 };
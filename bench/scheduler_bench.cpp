@@ -0,0 +1,344 @@
+/* OpenSprinkler Unified Firmware
+ * Copyright (C) 2015 by Ray Wang (ray@opensprinkler.com)
+ *
+ * Scheduler micro-benchmarks (RPI/LINUX only)
+ *
+ * Build with 'make bench' and run ./scheduler_bench [-d data_dir].
+ * The benchmark is compiled as DEMO firmware so it never touches
+ * real valves. It creates its own data files (in /tmp by default)
+ * and reports the cost of each scheduler hot path in ns/op,
+ * at several station counts up to MAX_NUM_STATIONS.
+ * The 1024 and 2040 zone cases only exist in 'make bench LARGE=1' builds.
+ * Figures quoted in commit messages so far were measured on an x86-64
+ * host, not on Raspberry Pi hardware: run it on the target for those.
+ *
+ * This file is part of the OpenSprinkler Firmware
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/stat.h>
+
+#include "types.h"
+#include "OpenSprinkler.h"
+#include "program.h"
+#include "main.h"
+#include "utils.h"
+
+extern OpenSprinkler os;
+extern ProgramData pd;
+extern char tmp_buffer[];
+extern ulong flow_count;
+void flow_poll();
+
+#define BENCH_MIN_NS   20000000ULL  // run each case for at least 20 ms
+#define BENCH_T0       1700000000L  // fixed reference time (Nov 14 2023)
+
+static volatile unsigned char bench_sink;
+
+static uint64_t nanos() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static void report(const char *name, unsigned int n, uint64_t ns, ulong ops) {
+	printf("%-28s n=%-4u %12.1f ns/op\n", name, n, ops ? (double)ns/ops : 0.0);
+}
+
+/** Set up controller with nst stations, group gid and master 1 on the last station */
+static void setup_stations(sid_t nst, unsigned char gid, bool master) {
+	os.iopts[IOPT_EXT_BOARDS] = nst/8-1;
+	os.iopts[IOPT_MASTER_STATION] = master ? ((nst>MAX_MASTER_STATION) ? MAX_MASTER_STATION : nst) : 0;
+	os.iopts[IOPT_MASTER_STATION_2] = 0;
+	os.iopts[IOPT_STATION_DELAY_TIME] = 120; // 0 seconds
+	os.iopts[IOPT_ENABLE_LOGGING] = 0;
+	os.iopts[IOPT_REMOTE_EXT_MODE] = 0;
+	os.iopts_save();
+	os.populate_master();
+	os.status.mas = os.iopts[IOPT_MASTER_STATION];
+	os.status.mas2 = 0;
+	for(sid_t sid=0;sid<nst;sid++) os.set_station_gid(sid, gid);
+	os.clear_all_station_bits();
+	os.apply_all_station_bits();
+	pd.reset_runtime();
+	os.status.program_busy = 0;
+}
+
+/** Enqueue every non-master station with duration dur */
+static void fill_queue(sid_t nst, uint16_t dur) {
+	for(sid_t sid=0;sid<nst;sid++) {
+		if(os.status.mas==sid+1) continue;
+		RuntimeQueueStruct *q = pd.enqueue();
+		if(!q) break;
+		q->st = 0;
+		q->dur = dur;
+		q->sid = sid;
+		q->pid = 1;
+	}
+}
+
+static void make_program(ProgramStruct *prog, sid_t nst, const char *name) {
+	memset(prog, 0, sizeof(ProgramStruct));
+	prog->enabled = 1;
+	prog->type = PROGRAM_TYPE_WEEKLY;
+	prog->days[0] = 0x7F;
+	prog->starttime_type = 1;
+	prog->starttimes[0] = 360;
+	prog->starttimes[1] = 720;
+	prog->starttimes[2] = 1080;
+	prog->starttimes[3] = -1;
+	prog->daterange[0] = MIN_ENCODED_DATE;
+	prog->daterange[1] = MAX_ENCODED_DATE;
+	for(sid_t sid=0;sid<nst;sid++) prog->durations[sid] = 600;
+	strncpy(prog->name, name, PROGRAM_NAME_SIZE-1);
+}
+
+/** Per-minute program matching: read each program's schedule and check_match */
+static void bench_check_match(pgid_t np) {
+	ProgramStruct prog;
+	pd.eraseall();
+	make_program(&prog, os.nstations, "bench");
+	for(pgid_t i=0;i<np;i++) pd.add(&prog);
+
+	bool will_delete;
+	time_os_t t = BENCH_T0;
+	ulong ops = 0;
+	unsigned char found = 0;
+	uint64_t t0 = nanos(), el;
+	do {
+		for(int k=0;k<64;k++, t+=60) {
+			for(pgid_t pid=0;pid<pd.nprograms;pid++) {
+				pd.read_sched(pid, &prog);
+				found += prog.check_match(t, &will_delete);
+			}
+			ops++;
+		}
+		el = nanos()-t0;
+	} while(el<BENCH_MIN_NS);
+	report("minute_match(sched+check)", np, el, ops);
+	bench_sink = found; // keep the result alive
+}
+
+/** check_match alone on an in-memory program */
+static void bench_check_match_mem() {
+	ProgramStruct prog;
+	make_program(&prog, os.nstations, "bench");
+	bool will_delete;
+	time_os_t t = BENCH_T0;
+	ulong ops = 0;
+	unsigned char found = 0;
+	uint64_t t0 = nanos(), el;
+	do {
+		for(int k=0;k<1024;k++, t+=60) found += prog.check_match(t, &will_delete);
+		ops += 1024;
+		el = nanos()-t0;
+	} while(el<BENCH_MIN_NS);
+	report("check_match", 1, el, ops);
+	bench_sink = found;
+}
+
+static void bench_runorder(sid_t nst, const char *label, const char *name) {
+	ProgramStruct prog;
+	make_program(&prog, nst, name);
+	sid_t order[MAX_NUM_STATIONS];
+	ulong ops = 0;
+	uint64_t t0 = nanos(), el;
+	do {
+		prog.gen_station_runorder(ops+1, order);
+		ops++;
+		el = nanos()-t0;
+	} while(el<BENCH_MIN_NS);
+	report(label, nst, el, ops);
+}
+
+/** Enqueue all stations and compute their start times */
+static void bench_schedule(sid_t nst, unsigned char gid, const char *label) {
+	setup_stations(nst, gid, true);
+	ulong ops = 0;
+	uint64_t t0 = nanos(), el;
+	do {
+		pd.reset_runtime();
+		fill_queue(nst, 600);
+		schedule_all_stations(BENCH_T0);
+		ops++;
+		el = nanos()-t0;
+	} while(el<BENCH_MIN_NS);
+	report(label, nst, el, ops);
+}
+
+/** Per-second queue bookkeeping, as run by do_loop */
+static void bench_tick(sid_t nst, unsigned char gid, uint16_t dur, const char *label) {
+	setup_stations(nst, gid, true);
+	ulong ops = 0;
+	uint64_t el = 0, t0;
+	do {
+		pd.reset_runtime();
+		os.clear_all_station_bits();
+		fill_queue(nst, dur);
+		schedule_all_stations(BENCH_T0);
+		time_os_t t = BENCH_T0;
+		t0 = nanos();
+		// run for at most 600 seconds of simulated time per round
+		for(int k=0;k<600 && os.status.program_busy;k++,t++) {
+			process_runtime_queue(t);
+			process_master_stations(t);
+			ops++;
+		}
+		el += nanos()-t0;
+	} while(el<BENCH_MIN_NS);
+	report(label, nst, el, ops);
+}
+
+static void bench_dynamic_events(sid_t nst) {
+	setup_stations(nst, PARALLEL_GROUP_ID, true);
+	fill_queue(nst, 3600);
+	schedule_all_stations(BENCH_T0);
+	process_runtime_queue(BENCH_T0+10);
+	ulong ops = 0;
+	time_os_t t = BENCH_T0+10;
+	uint64_t t0 = nanos(), el;
+	do {
+		for(int k=0;k<64;k++) process_dynamic_events(t);
+		ops += 64;
+		el = nanos()-t0;
+	} while(el<BENCH_MIN_NS);
+	report("process_dynamic_events", nst, el, ops);
+}
+
+/** Turn off (and dequeue) every running station */
+static void bench_turn_off(sid_t nst) {
+	setup_stations(nst, PARALLEL_GROUP_ID, false);
+	ulong ops = 0;
+	uint64_t el = 0, t0;
+	do {
+		pd.reset_runtime();
+		fill_queue(nst, 3600);
+		schedule_all_stations(BENCH_T0);
+		process_runtime_queue(BENCH_T0+10);
+		time_os_t t = BENCH_T0+10;
+		t0 = nanos();
+		for(sid_t sid=0;sid<nst;sid++) {
+			if(pd.station_qid[sid]==QID_NONE) continue;
+			pd.queue[pd.station_qid[sid]].deque_time = t;
+			turn_off_station(sid, t);
+			ops++;
+		}
+		el += nanos()-t0;
+	} while(el<BENCH_MIN_NS);
+	report("turn_off_station", nst, el, ops);
+}
+
+/** Station output path (one station changed per op), written through the gpio backend */
+static void bench_outputs(sid_t nst) {
+	setup_stations(nst, PARALLEL_GROUP_ID, false);
+	os.status.enabled = 1;
+	sim_gpio.clear();
+	ulong ops = 0;
+	sid_t sid = 0;
+	uint64_t t0 = nanos(), el;
+	do {
+		for(int k=0;k<64;k++) {
+			os.set_station_bit(sid, ((os.station_bits[sid>>3]>>(sid&0x07))&1) ? 0 : 1);
+			os.apply_all_station_bits();
+			if(++sid>=nst) sid = 0;
+		}
+		ops += 64;
+		el = nanos()-t0;
+	} while(el<BENCH_MIN_NS);
+	report("apply_all_station_bits", nst, el, ops);
+	if(gpio_backend()==&sim_gpio) {
+		printf("%-28s n=%-4u %12.1f transitions/op\n", "  (sim gpio)", nst, (double)sim_gpio.nevents/ops);
+	}
+	os.clear_all_station_bits();
+	os.apply_all_station_bits();
+}
+
+/** Flow sensor pulse counting, with the pulses injected by the simulated gpio backend */
+static void bench_flow() {
+	if(gpio_backend()!=&sim_gpio) return;
+	pinMode(PIN_SENSOR1, INPUT_PULLUP);
+	ulong start = flow_count;
+	ulong ops = 0;
+	uint64_t t0 = nanos(), el;
+	do {
+		for(int k=0;k<256;k++) {
+			sim_gpio.inject(PIN_SENSOR1, LOW);
+			flow_poll();
+			sim_gpio.inject(PIN_SENSOR1, HIGH);
+			flow_poll();
+		}
+		ops += 256;
+		el = nanos()-t0;
+	} while(el<BENCH_MIN_NS);
+	report("flow_pulse", 1, el, ops);
+	if(flow_count-start!=ops) printf("flow count mismatch: %lu pulses, %lu counted\n", ops, flow_count-start);
+}
+
+int main(int argc, char *argv[]) {
+	const char *dir = "/tmp/os_bench/";
+	int opt;
+	while(-1 != (opt = getopt(argc, argv, "d:"))) {
+		if(opt=='d') dir = optarg;
+	}
+	mkdir(dir, 0755);
+	set_data_dir(dir);
+	initialiseEpoch();
+	os.begin();
+	os.options_setup();
+	pd.init();
+
+	// scramble station names so that name ordering does real work
+	srand(1);
+	for(sid_t sid=0;sid<MAX_NUM_STATIONS;sid++) {
+		snprintf(tmp_buffer, STATION_NAME_SIZE, "Zone %c%c %d", 'A'+rand()%26, 'a'+rand()%26, sid);
+		os.set_station_name(sid, tmp_buffer);
+	}
+
+	printf("OpenSprinkler scheduler benchmark (MAX_NUM_STATIONS=%d, RUNTIME_QUEUE_SIZE=%d, gpio=%s)\n", MAX_NUM_STATIONS, RUNTIME_QUEUE_SIZE, gpio_backend()->name());
+
+#if defined(LARGE_INSTALL)
+	sid_t sizes[] = {8, 32, 64, 128, 256, 1024, MAX_NUM_STATIONS};
+#else
+	sid_t sizes[] = {8, 32, 64, 128, MAX_NUM_STATIONS};
+#endif
+
+	setup_stations(MAX_NUM_STATIONS, 0, false);
+	pgid_t nprogs[] = {1, 10, 40, MAX_NUM_PROGRAMS};
+	bench_check_match_mem();
+	bench_flow();
+	for(unsigned char i=0;i<sizeof(nprogs)/sizeof(nprogs[0]);i++) bench_check_match(nprogs[i]);
+	pd.eraseall();
+
+	for(unsigned char i=0;i<sizeof(sizes)/sizeof(sizes[0]);i++) {
+		sid_t n = sizes[i];
+		setup_stations(n, 0, false);
+		bench_runorder(n, "runorder(index)", "bench");
+		bench_runorder(n, "runorder(name >n)", "bench>n");
+		bench_runorder(n, "runorder(alternate >t)", "bench>t");
+		bench_runorder(n, "runorder(random >r)", "bench>r");
+		bench_schedule(n, 0, "schedule_all(sequential)");
+		bench_schedule(n, PARALLEL_GROUP_ID, "schedule_all(parallel)");
+		bench_tick(n, PARALLEL_GROUP_ID, 3600, "tick(steady parallel)");
+		bench_tick(n, 0, 2, "tick(sequential churn)");
+		bench_dynamic_events(n);
+		bench_turn_off(n);
+		bench_outputs(n);
+	}
+	return 0;
+}
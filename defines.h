@@ -54,7 +54,9 @@ typedef unsigned long ulong;
 #define STATIONS_FILENAME     "stns.dat"    // stations data file
 #define NVCON_FILENAME        "nvcon.dat"   // non-volatile controller data file, see OpenSprinkler.h --> struct NVConData
 #define PROG_FILENAME         "prog.dat"    // program data file
+#define PROG_BACKUP_FILENAME  "prog.bak"    // program file this build couldn't read, set aside
 #define DONE_FILENAME         "done.dat"    // used to indicate the completion of all files
+#define QUEUE_FILENAME        "queue.dat"   // runtime queue snapshot (Linux only), restored after a restart
 
 /** Station macro defines */
 #define STN_TYPE_STANDARD    0x00 // standard solenoid station
@@ -134,12 +136,15 @@ enum {
 /** Storage / zone expander defines */
 #if defined(ARDUINO)
 	#define MAX_EXT_BOARDS    8  // maximum number of 8-zone expanders (each 16-zone expander counts as 2)
+#elif defined(LARGE_INSTALL)
+	#define MAX_EXT_BOARDS    254 // large-install build: 2040 zones, the most that 1-byte board indices can address
 #else
 	#define MAX_EXT_BOARDS    24 // allow more zones for linux-based firmwares
 #endif
 
 #define MAX_NUM_BOARDS    (1+MAX_EXT_BOARDS)  // maximum number of 8-zone boards including expanders
 #define MAX_NUM_STATIONS  (MAX_NUM_BOARDS*8)  // maximum number of stations
+#define MAX_MASTER_STATION ((MAX_NUM_STATIONS>255) ? 255 : MAX_NUM_STATIONS) // master stations are stored as 1-byte options
 #define STATION_NAME_SIZE 32    // maximum number of characters in each station name
 #define MAX_SOPTS_SIZE    320   // maximum string option size
 
@@ -160,7 +165,10 @@ enum {
 #define DEFAULT_EMPTY_STRING      ""
 #define DEFAULT_UNDERCURRENT_THRESHOLD 100 // in mA
 #define DEFAULT_OVERCURRENT_LIMIT 1200 // in mA
+#define DEFAULT_CATCHUP_WINDOW 5 // in minutes, used when the option is 0 (installs from before it existed)
+#define CATCHUP_WINDOW_OFF 255 // option value that turns catch-up off
 #define OVERCURRENT_INRUSH_EXTRA   600 // in mA
+#define CURRENT_BUDGET_MARGIN      100 // in mA, kept below the overcurrent limit when packing concurrent stations
 
 #if (defined(__AVR_ATmega1284P__) || defined(__AVR_ATmega1284__))
 	#define OS_AVR
@@ -195,9 +203,23 @@ enum {
 };
 
 // Sequential Groups
-#define NUM_SEQ_GROUPS		4
+#define DEFAULT_SEQ_GROUPS	4
+#if defined(ARDUINO)
+	#define MAX_SEQ_GROUPS	8
+#else
+	#define MAX_SEQ_GROUPS	32  // at most 32, as groups are tracked in a 32-bit mask
+#endif
 #define PARALLEL_GROUP_ID	255
 
+/** Queue merge policy, for a program run of a station that already has a pending run */
+enum {
+	QUEUE_MERGE_APPEND = 0, // queue the new run after the pending one
+	QUEUE_MERGE_EXTEND,     // add the new duration to the pending run
+	QUEUE_MERGE_REPLACE,    // the new run replaces the pending run
+	QUEUE_MERGE_MAX,        // keep whichever run is longer
+	NUM_QUEUE_MERGE_POLICIES
+};
+
 /** Macro define of each option
   * Refer to OpenSprinkler.cpp for details on each option
   */
@@ -270,11 +292,13 @@ enum {
 	IOPT_NOTIF2_ENABLE,
 	IOPT_I_MIN_THRESHOLD,
 	IOPT_I_MAX_LIMIT,
-	IOPT_RESERVE_6,
-	IOPT_RESERVE_7,
-	IOPT_RESERVE_8,
+	IOPT_CATCHUP_WINDOW,
+	IOPT_MASTER_CAPACITY,
+	IOPT_MASTER_CAPACITY_2,
 	IOPT_WIFI_MODE, //ro
 	IOPT_RESET,     //ro
+	IOPT_SEQ_GROUPS, // appended, so older option files load with the default
+	IOPT_QUEUE_MERGE,
 	NUM_IOPTS // total number of integer options
 };
 
@@ -474,13 +498,14 @@ enum {
 	#else
 		#define OS_HW_VERSION SIM_HW_VERSION_BASE
 	#endif
-	#define PIN_SR_LATCH    0
-	#define PIN_SR_DATA     0
-	#define PIN_SR_CLOCK    0
-	#define PIN_SR_OE       0
-	#define PIN_SENSOR1     0
-	#define PIN_SENSOR2     0
-	#define PIN_RFTX        0
+	// same numbers as OSPi, so that the simulated gpio backend sees separate pins
+	#define PIN_SR_LATCH   22
+	#define PIN_SR_DATA    27
+	#define PIN_SR_CLOCK    4
+	#define PIN_SR_OE      17
+	#define PIN_SENSOR1    14
+	#define PIN_SENSOR2    23
+	#define PIN_RFTX       15
 	#define PIN_FREE_LIST  {}
 	#define ETHER_BUFFER_SIZE   16384
 
@@ -58,6 +58,12 @@ void PCA9555::pinMode(uint8_t pin, uint8_t IOMode) {
 }
 
 uint16_t PCA9555::i2c_read(uint8_t reg) {
+	// the output register only changes when it's written, so there's no need to read it back
+	if(reg==NXP_OUTPUT_REG && out_valid) return out_shadow;
+	return read_reg(reg);
+}
+
+uint16_t PCA9555::read_reg(uint8_t reg) {
 	if(address==255)	return 0xFFFF;
 	Wire.beginTransmission(address);
 	Wire.write(reg);
@@ -75,6 +81,16 @@ void PCA9555::i2c_write(uint8_t reg, uint16_t v){
 	Wire.write(v&0xff);
 	Wire.write(v>>8);
 	Wire.endTransmission();
+	if(reg==NXP_OUTPUT_REG) {
+		out_shadow = v;
+		out_valid = true;
+	}
+}
+
+/** Read the output register back and rewrite it if it has changed (e.g. after a glitch) */
+void PCA9555::output_verify() {
+	if(!out_valid) return;
+	if(read_reg(NXP_OUTPUT_REG)!=out_shadow) i2c_write(NXP_OUTPUT_REG, out_shadow);
 }
 
 void PCA9555::shift_out(uint8_t plat, uint8_t pclk, uint8_t pdat, uint8_t v) {
@@ -122,6 +138,8 @@ void PCF8575::i2c_write(uint8_t reg, uint16_t v) {
 	Wire.write(v&0xff);
 	Wire.write(v>>8);
 	Wire.endTransmission();
+	out_shadow = v;
+	out_valid = true;
 }
 
 uint16_t PCF8574::i2c_read(uint8_t reg) {
@@ -138,6 +156,8 @@ void PCF8574::i2c_write(uint8_t reg, uint16_t v) {
 	Wire.beginTransmission(address);
 	Wire.write((uint8_t)(v&0xFF) | inputmask);
 	Wire.endTransmission();
+	out_shadow = v;
+	out_valid = true;
 }
 
 #include "OpenSprinkler.h"
@@ -196,12 +216,35 @@ unsigned char digitalReadExt(unsigned char pin) {
 #include <poll.h>
 #include <pthread.h>
 #include <gpiod.h>
+#include <linux/i2c-dev.h>
+#if defined(SR_SPIDEV)
+#include <linux/spi/spidev.h>
+#endif
+extern "C" {
+#include <i2c/smbus.h>
+}
 
 #include "utils.h"
 
 #define BUFFER_MAX 64
 #define GPIO_MAX	 64
 
+/** libgpiod backend (the real hardware) */
+class GPIODBackend : public GPIOBackend {
+public:
+	const char *name() { return "gpiod"; }
+	void pinMode(int pin, unsigned char mode);
+	void digitalWrite(int pin, unsigned char value);
+	unsigned char digitalRead(int pin);
+	int edge_fd(int pin);
+	void shift_out_latch(int pin_latch, int pin_clock, int pin_data, const unsigned char *bytes, int nbytes);
+	int i2c_open(const char *bus, unsigned char addr);
+	int i2c_write_byte(int h, unsigned char reg, unsigned char data);
+	int i2c_write_block(int h, unsigned char reg, unsigned char len, const unsigned char *data);
+};
+
+static GPIODBackend gpiod_gpio;
+
 // GPIO interfaces
 const char *gpio_consumer = "opensprinkler";
 
@@ -282,8 +325,127 @@ int assert_gpiod_line(int pin) {
 	return 0;
 }
 
+/** Shift register lines (latch, clock, data), requested as one line set
+ * so that all three are changed with a single call. While the set is held,
+ * digitalWrite on these pins goes through it as well
+ */
+static struct gpiod_line_bulk sr_bulk;
+static int sr_pins[3] = {-1, -1, -1};
+static int sr_values[3];
+static bool sr_bulk_failed = false;
+
+static int sr_index(int pin) {
+	for(int i=0;i<3;i++) {
+		if(sr_pins[i]==pin) return i;
+	}
+	return -1;
+}
+
+static void sr_release() {
+	if(sr_pins[0]<0) return;
+	gpiod_line_release_bulk(&sr_bulk);
+	sr_pins[0] = sr_pins[1] = sr_pins[2] = -1;
+}
+
+static int assert_sr_bulk(int plat, int pclk, int pdat) {
+	if(sr_pins[0]==plat && sr_pins[1]==pclk && sr_pins[2]==pdat) return 0;
+	int pins[3] = {plat, pclk, pdat};
+	for(int i=0;i<3;i++) { // open all lines before releasing any, so a failure leaves them requested
+		if( assert_gpiod_line(pins[i]) ) { return -1; }
+	}
+	sr_release();
+	gpiod_line_bulk_init(&sr_bulk);
+	for(int i=0;i<3;i++) {
+		sr_values[i] = LOW;
+		if( gpiod_line_is_requested(gpio_lines[pins[i]]) ) { // keep the current level
+			int val = gpiod_line_get_value(gpio_lines[pins[i]]);
+			if( val > 0 ) sr_values[i] = HIGH;
+			gpiod_line_release(gpio_lines[pins[i]]);
+		}
+		gpiod_line_bulk_add(&sr_bulk, gpio_lines[pins[i]]);
+	}
+	if( gpiod_line_request_bulk_output(&sr_bulk, gpio_consumer, sr_values) ) {
+		DEBUG_PRINTLN("failed to request shift register lines together");
+		for(int i=0;i<3;i++) { // take the lines back one by one, at their levels, for the fallback
+			if( gpiod_line_request_output(gpio_lines[pins[i]], gpio_consumer, sr_values[i]) ) {
+				DEBUG_PRINT("failed to request gpio line ");
+				DEBUG_PRINTLN(pins[i]);
+			}
+		}
+		return -1;
+	}
+	memcpy(sr_pins, pins, sizeof(sr_pins));
+	return 0;
+}
+
+static void sr_write() {
+	if( gpiod_line_set_value_bulk(&sr_bulk, sr_values) ) {
+		DEBUG_PRINTLN("failed to write shift register lines");
+	}
+}
+
+#if defined(SR_SPIDEV)
+#if !defined(SR_SPI_SPEED)
+#define SR_SPI_SPEED 1000000 // shift register clock (in Hz) when driven by SPI
+#endif
+/** Open the SPI device that drives the shift register clock and data (if wired that way) */
+static int assert_sr_spi() {
+	static int fd = -2;
+	if( fd == -2 ) {
+		fd = open(SR_SPIDEV, O_WRONLY);
+		if( fd < 0 ) {
+			DEBUG_PRINTLN("failed to open " SR_SPIDEV ", using gpio for the shift register");
+			return -1;
+		}
+		uint8_t mode = SPI_MODE_0;
+		uint32_t speed = SR_SPI_SPEED;
+		ioctl(fd, SPI_IOC_WR_MODE, &mode);
+		ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed);
+	}
+	return fd;
+}
+#endif
+
+/** Clock bytes out to the shift registers and latch them
+ * With SR_SPIDEV, the bytes go out in one SPI transfer. Otherwise clock, data
+ * and latch are changed together, which takes two calls per bit instead of three
+ */
+void GPIODBackend::shift_out_latch(int pin_latch, int pin_clock, int pin_data, const unsigned char *bytes, int nbytes) {
+#if defined(SR_SPIDEV)
+	int fd = assert_sr_spi();
+	if( fd >= 0 ) {
+		digitalWrite(pin_latch, LOW);
+		if( write(fd, bytes, nbytes) != nbytes ) {
+			DEBUG_PRINTLN("failed to write shift register over SPI");
+		}
+		digitalWrite(pin_latch, HIGH);
+		return;
+	}
+#endif
+	if( !sr_bulk_failed && assert_sr_bulk(pin_latch, pin_clock, pin_data) ) {
+		sr_bulk_failed = true;
+	}
+	if( sr_bulk_failed ) {
+		GPIOBackend::shift_out_latch(pin_latch, pin_clock, pin_data, bytes, nbytes);
+		return;
+	}
+	sr_values[0] = LOW; // goes out with the first bit
+	for(int i=0;i<nbytes;i++) {
+		for(int s=7;s>=0;s--) {
+			sr_values[1] = LOW;
+			sr_values[2] = (bytes[i]>>s)&1;
+			sr_write();
+			sr_values[1] = HIGH;
+			sr_write();
+		}
+	}
+	sr_values[0] = HIGH;
+	sr_write();
+}
+
 /** Set pin mode, in or out */
-void pinMode(int pin, unsigned char mode) {
+void GPIODBackend::pinMode(int pin, unsigned char mode) {
+	if( sr_index(pin) >= 0 ) { sr_release(); }
 	if( assert_gpiod_line(pin) ) { return; }
 	switch(mode) {
 		case INPUT:
@@ -304,7 +466,7 @@ void pinMode(int pin, unsigned char mode) {
 }
 
 /** Read digital value */
-unsigned char digitalRead(int pin) {
+unsigned char GPIODBackend::digitalRead(int pin) {
 	if( !gpio_lines[pin] ) {
 		DEBUG_PRINT("tried to read uninitialized pin ");
 		DEBUG_PRINTLN(pin);
@@ -320,7 +482,13 @@ unsigned char digitalRead(int pin) {
 }
 
 /** Write digital value */
-void digitalWrite(int pin, unsigned char value) {
+void GPIODBackend::digitalWrite(int pin, unsigned char value) {
+	int k = sr_index(pin);
+	if( k >= 0 ) { // part of the shift register line set
+		sr_values[k] = value ? HIGH : LOW;
+		sr_write();
+		return;
+	}
 	if( !gpio_lines[pin] ) {
 		DEBUG_PRINT("tried to write uninitialized pin ");
 		DEBUG_PRINTLN(pin);
@@ -335,10 +503,180 @@ void digitalWrite(int pin, unsigned char value) {
 	}
 }
 
+/** Request both-edge events on an input pin (with pull-up)
+ * Returns a file descriptor that becomes readable on each edge, or -1.
+ * The value can still be read with digitalRead.
+ */
+int GPIODBackend::edge_fd(int pin) {
+	if( assert_gpiod_line(pin) ) { return -1; }
+	if( gpiod_line_is_requested(gpio_lines[pin]) ) {
+		gpiod_line_release(gpio_lines[pin]);
+	}
+	if( gpiod_line_request_both_edges_events_flags(gpio_lines[pin], gpio_consumer, GPIOD_LINE_REQUEST_FLAG_BIAS_PULL_UP) ) {
+		DEBUG_PRINT("failed to request edge events on pin ");
+		DEBUG_PRINTLN(pin);
+		pinMode(pin, INPUT_PULLUP);
+		return -1;
+	}
+	return gpiod_line_event_get_fd(gpio_lines[pin]);
+}
+
+int GPIODBackend::i2c_open(const char *bus, unsigned char addr) {
+	int fd = open(bus, O_RDWR);
+	if( fd < 0 ) { return -1; }
+	if( ioctl(fd, I2C_SLAVE, addr) < 0 ) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int GPIODBackend::i2c_write_byte(int h, unsigned char reg, unsigned char data) {
+	return i2c_smbus_write_byte_data(h, reg, data);
+}
+
+int GPIODBackend::i2c_write_block(int h, unsigned char reg, unsigned char len, const unsigned char *data) {
+	return i2c_smbus_write_i2c_block_data(h, reg, len, data);
+}
+
+#endif
+
+#if !defined(ARDUINO)
+
+#include <time.h>
+#include <unistd.h>
+#include <string.h>
+
+void GPIOBackend::shift_out_latch(int pin_latch, int pin_clock, int pin_data, const unsigned char *bytes, int nbytes) {
+	digitalWrite(pin_latch, LOW);
+	for(int i=0;i<nbytes;i++) {
+		for(int s=7;s>=0;s--) {
+			digitalWrite(pin_clock, LOW);
+			digitalWrite(pin_data, (bytes[i]>>s)&1);
+			digitalWrite(pin_clock, HIGH);
+		}
+	}
+	digitalWrite(pin_latch, HIGH);
+}
+
+SimGPIO sim_gpio;
+
+SimGPIO::SimGPIO() {
+	memset(modes, INPUT, sizeof(modes));
+	memset(levels, LOW, sizeof(levels));
+	for(int i=0;i<SIM_GPIO_PINS;i++) edge_pipe[i][0] = edge_pipe[i][1] = -1;
+	ni2c = 0;
+	clear();
+}
+
+/** Forget the recorded events (the pin states are kept) */
+void SimGPIO::clear() {
+	nevents = writes = i2c_bytes = 0;
+}
+
+void SimGPIO::record(uint16_t pin, uint16_t value) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	SimEvent *e = log + (nevents % SIM_GPIO_LOG_SIZE);
+	e->ns = (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+	e->pin = pin;
+	e->value = value;
+	nevents++;
+}
+
+const SimEvent *SimGPIO::event(ulong i) {
+	if(i>=nevents || nevents-i>SIM_GPIO_LOG_SIZE) return NULL;
+	return log + (i % SIM_GPIO_LOG_SIZE);
+}
+
+void SimGPIO::pinMode(int pin, unsigned char mode) {
+	if(pin<0 || pin>=SIM_GPIO_PINS) return;
+	modes[pin] = mode;
+	if(mode==INPUT_PULLUP) levels[pin] = HIGH;
+}
+
+void SimGPIO::digitalWrite(int pin, unsigned char value) {
+	if(pin<0 || pin>=SIM_GPIO_PINS) return;
+	writes++;
+	value = value ? HIGH : LOW;
+	if(modes[pin]!=OUTPUT || levels[pin]==value) return;
+	levels[pin] = value;
+	record(pin, value);
+}
+
+unsigned char SimGPIO::digitalRead(int pin) {
+	if(pin<0 || pin>=SIM_GPIO_PINS) return 0;
+	return levels[pin];
+}
+
+/** A pipe that gets a byte for every injected edge (drained by wait_for_events) */
+int SimGPIO::edge_fd(int pin) {
+	if(pin<0 || pin>=SIM_GPIO_PINS) return -1;
+	if(edge_pipe[pin][0]<0 && pipe(edge_pipe[pin])) return -1;
+	fcntl(edge_pipe[pin][1], F_SETFL, O_NONBLOCK);
+	return edge_pipe[pin][0];
+}
+
+void SimGPIO::inject(int pin, unsigned char value) {
+	if(pin<0 || pin>=SIM_GPIO_PINS) return;
+	value = value ? HIGH : LOW;
+	if(levels[pin]==value) return;
+	levels[pin] = value;
+	record(pin, value);
+	if(edge_pipe[pin][1]>=0) {
+		char c = 0;
+		if(write(edge_pipe[pin][1], &c, 1) < 0) {} // a full pipe already means "edge pending"
+	}
+}
+
+int SimGPIO::i2c_open(const char *bus, unsigned char addr) {
+	for(unsigned char i=0;i<ni2c;i++) {
+		if(i2c_addrs[i]==addr) return i;
+	}
+	if(ni2c>=sizeof(i2c_addrs)) return -1;
+	i2c_addrs[ni2c] = addr;
+	return ni2c++;
+}
+
+int SimGPIO::i2c_write_byte(int h, unsigned char reg, unsigned char data) {
+	return i2c_write_block(h, reg, 1, &data);
+}
+
+int SimGPIO::i2c_write_block(int h, unsigned char reg, unsigned char len, const unsigned char *data) {
+	if(h<0 || h>=ni2c) return -1;
+	record(SIM_I2C_EVENT|i2c_addrs[h], ((uint16_t)reg<<8)|(len?data[0]:0));
+	i2c_bytes += len;
+	return 0;
+}
+
+#if defined(OSPI)
+static GPIOBackend *backend = &gpiod_gpio;
 #else
+static GPIOBackend *backend = &sim_gpio;
+#endif
+
+GPIOBackend *gpio_backend() { return backend; }
 
-void pinMode(int pin, unsigned char mode) {}
-void digitalWrite(int pin, unsigned char value) {}
-unsigned char digitalRead(int pin) {return 0;}
+bool gpio_select_backend(const char *name) {
+#if defined(OSPI)
+	if(!strcmp(name, gpiod_gpio.name())) {
+		backend = &gpiod_gpio;
+		return true;
+	}
+#endif
+	if(!strcmp(name, sim_gpio.name())) {
+		backend = &sim_gpio;
+		return true;
+	}
+	return false;
+}
+
+void pinMode(int pin, unsigned char mode) { backend->pinMode(pin, mode); }
+void digitalWrite(int pin, unsigned char value) { backend->digitalWrite(pin, value); }
+unsigned char digitalRead(int pin) { return backend->digitalRead(pin); }
+int gpio_edge_fd(int pin) { return backend->edge_fd(pin); }
+void shift_out_latch(int pin_latch, int pin_clock, int pin_data, const unsigned char *bytes, int nbytes) {
+	backend->shift_out_latch(pin_latch, pin_clock, pin_data, bytes, nbytes);
+}
 
 #endif
@@ -44,13 +44,23 @@
 
 class IOEXP {
 public:
-	IOEXP(uint8_t addr=255) { address = addr; type = IOEXP_TYPE_NONEXIST; }
+	IOEXP(uint8_t addr=255) { address = addr; type = IOEXP_TYPE_NONEXIST; out_valid = false; }
 
 	virtual void pinMode(uint8_t pin, uint8_t IOMode) { }
 	virtual uint16_t i2c_read(uint8_t reg) { return 0xFFFF; }
 	virtual void i2c_write(uint8_t reg, uint16_t v) { }
 	// software implementation of shift register out
 	virtual void shift_out(uint8_t plat, uint8_t pclk, uint8_t pdat, uint8_t v) { }
+	// make sure the outputs still hold the last written value (rewrite them by default)
+	virtual void output_verify() {
+		if(out_valid) i2c_write(NXP_OUTPUT_REG, out_shadow);
+	}
+
+	// write the output register, unless v is what it already holds
+	void output_write(uint16_t v) {
+		if(out_valid && v==out_shadow) return;
+		i2c_write(NXP_OUTPUT_REG, v);
+	}
 
 	void digitalWrite(uint16_t v) {
 		i2c_write(NXP_OUTPUT_REG, v);
@@ -74,15 +84,21 @@ public:
 	static unsigned char detectType(uint8_t address);
 	uint8_t address;
 	uint8_t type;
+protected:
+	uint16_t out_shadow;  // last value written to the output register
+	bool out_valid;       // out_shadow holds a written value
 };
 
 class PCA9555 : public IOEXP {
 public:
 	PCA9555(uint8_t addr) { address = addr; type = IOEXP_TYPE_9555; }
 	void pinMode(uint8_t pin, uint8_t IOMode);
-	uint16_t i2c_read(uint8_t reg);
+	uint16_t i2c_read(uint8_t reg); // the output register is served from its shadow
 	void i2c_write(uint8_t reg, uint16_t v);
 	void shift_out(uint8_t plat, uint8_t pclk, uint8_t pdat, uint8_t v);
+	void output_verify();
+private:
+	uint16_t read_reg(uint8_t reg);
 };
 
 class PCF8575 : public IOEXP {
@@ -120,6 +136,7 @@ unsigned char digitalReadExt(unsigned char pin);
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <stdint.h>
 
 #include "defines.h"
 #define OUTPUT 0
@@ -140,9 +157,81 @@ int gpio_fd_open(int pin, int mode = O_WRONLY);
 void gpio_fd_close(int fd);
 void gpio_write(int fd, unsigned char value);
 unsigned char digitalRead(int pin);
+int gpio_edge_fd(int pin);
+// clock nbytes out to a chain of shift registers (first byte first, msb first), then latch them
+void shift_out_latch(int pin_latch, int pin_clock, int pin_data, const unsigned char *bytes, int nbytes);
 // mode can be any of 'rising', 'falling', 'both'
 void attachInterrupt(int pin, const char* mode, void (*isr)(void));
 
+/** GPIO/I2C backend
+ * The functions above (and I2CDevice) go through the selected backend:
+ * libgpiod on OSPI, and the in-process simulator on DEMO (or OSPI with -g sim)
+ */
+class GPIOBackend {
+public:
+	virtual ~GPIOBackend() {}
+	virtual const char *name() = 0;
+	virtual void pinMode(int pin, unsigned char mode) = 0;
+	virtual void digitalWrite(int pin, unsigned char value) = 0;
+	virtual unsigned char digitalRead(int pin) = 0;
+	virtual int edge_fd(int pin) { return -1; }
+	// bit-banged through digitalWrite unless the backend has something faster
+	virtual void shift_out_latch(int pin_latch, int pin_clock, int pin_data, const unsigned char *bytes, int nbytes);
+	// I2C: open returns a handle (or -1), writes return 0 on success
+	virtual int i2c_open(const char *bus, unsigned char addr) { return -1; }
+	virtual int i2c_write_byte(int h, unsigned char reg, unsigned char data) { return -1; }
+	virtual int i2c_write_block(int h, unsigned char reg, unsigned char len, const unsigned char *data) { return -1; }
+};
+
+GPIOBackend *gpio_backend();
+// select a backend by name ("gpiod" or "sim"), returns false if it's not available
+bool gpio_select_backend(const char *name);
+
+#define SIM_GPIO_PINS     64
+#define SIM_GPIO_LOG_SIZE 4096    // events kept by the simulator (the oldest are overwritten)
+#define SIM_I2C_EVENT     0x100   // SimEvent.pin for I2C writes (ored with the device address)
+
+struct SimEvent {
+	uint64_t ns;     // CLOCK_MONOTONIC time stamp
+	uint16_t pin;    // gpio pin, or SIM_I2C_EVENT|address
+	uint16_t value;  // new level, or register<<8|first data byte
+};
+
+/** Simulated hardware: keeps the pin levels in memory, records every output transition
+ * and I2C write with a time stamp, and lets inputs (e.g. flow sensor pulses) be injected.
+ * Not thread safe, so it should only be used from the main loop
+ */
+class SimGPIO : public GPIOBackend {
+public:
+	SimGPIO();
+	const char *name() { return "sim"; }
+	void pinMode(int pin, unsigned char mode);
+	void digitalWrite(int pin, unsigned char value);
+	unsigned char digitalRead(int pin);
+	int edge_fd(int pin);
+	int i2c_open(const char *bus, unsigned char addr);
+	int i2c_write_byte(int h, unsigned char reg, unsigned char data);
+	int i2c_write_block(int h, unsigned char reg, unsigned char len, const unsigned char *data);
+
+	void inject(int pin, unsigned char value); // drive an input pin (wakes up edge_fd on a change)
+	const SimEvent *event(ulong i); // the i-th recorded event, or NULL if it has been overwritten
+	void clear();
+
+	ulong nevents;    // events recorded so far
+	ulong writes;     // digitalWrite calls (including the ones that didn't change the level)
+	ulong i2c_bytes;  // I2C data bytes written
+private:
+	void record(uint16_t pin, uint16_t value);
+	unsigned char modes[SIM_GPIO_PINS];
+	unsigned char levels[SIM_GPIO_PINS];
+	int edge_pipe[SIM_GPIO_PINS][2];
+	unsigned char i2c_addrs[16];
+	unsigned char ni2c;
+	SimEvent log[SIM_GPIO_LOG_SIZE];
+};
+
+extern SimGPIO sim_gpio;
+
 #endif
 
 #endif // GPIO_H
@@ -1,27 +1,17 @@
 #ifndef I2CD_H
 #define I2CD_H
 
-#include <fcntl.h>
-#include <sys/ioctl.h>
-
-extern "C" {
-#include <i2c/smbus.h>
-#include <linux/i2c-dev.h>
 #include <string.h>
+#include "gpio.h"
 #include "utils.h"
-}
 
 class I2CDevice {
 public:
   I2CDevice() {}
 
   int begin(const char *bus, unsigned char addr) {
-    _file = open(bus, O_RDWR);
-    if (_file < 0) {
-      return _file;
-    }
-
-    return ioctl(_file, I2C_SLAVE, addr);
+    _file = gpio_backend()->i2c_open(bus, addr);
+    return _file < 0 ? -1 : 0;
   }
 
   int begin(unsigned char addr) { return begin(getDefaultBus(), addr); }
@@ -63,7 +53,7 @@ public:
       transaction_buffer_length++;
       return res;
     } else {
-      return i2c_smbus_write_byte_data(_file, reg, data);
+      return gpio_backend()->i2c_write_byte(_file, reg, data);
     }
   }
 
@@ -90,7 +80,7 @@ private:
    }
 
   int send_transaction() {
-    return i2c_smbus_write_i2c_block_data(
+    return gpio_backend()->i2c_write_block(
         _file, transaction_id, transaction_buffer_length, transaction_buffer);
   }
 };
@@ -72,7 +72,7 @@
 
 const char *user_agent_string = "OpenSprinkler/" TOSTRING(OS_FW_VERSION) "#" TOSTRING(OS_FW_MINOR);
 
-void manual_start_program(unsigned char, unsigned char);
+void manual_start_program(pgid_t, unsigned char);
 
 // Small variations have been added to the timing values below
 // to minimize conflicting events
@@ -87,6 +87,8 @@ void manual_start_program(unsigned char, unsigned char);
 #define DHCP_CHECKLEASE_INTERVAL  3600L // DHCP check lease interval (in seconds)
 #define FLOWPOLL_INTERVAL         5     // flow poll interval (in milli-seconds)
 #define CURRPOLL_INTERVAL         20    // current poll interval (in milli-seconds)
+#define CATCHUP_FORWARD_LIMIT     1440  // missed minutes are only caught up if the clock moved forward by at most this many minutes
+#define CATCHUP_BACKWARD_LIMIT    60    // after the clock goes back, programs are held for at most this many minutes so they don't re-run
 // Define buffers: need them to be sufficiently large to cover string option reading
 char ether_buffer[ETHER_BUFFER_SIZE*2]; // ethernet buffer, make it twice as large to allow overflow
 char tmp_buffer[TMP_BUFFER_SIZE*2]; // scratch buffer, make it twice as large to allow overflow
@@ -108,7 +110,7 @@ unsigned char prev_flow_state = HIGH;
 float flow_last_gpm = 0;
 int32_t flow_rt_period = -1;
 uint32_t reboot_timer = 0;
-unsigned char curr_alert_sid = 0;
+sid_t curr_alert_sid = 0;
 
 void flow_poll() {
 	ulong curr = millis();
@@ -190,7 +192,7 @@ static char ui_anim_chars[3] = {'.', 'o', 'O'};
 #define UI_STATE_RUNPROG   3
 
 static unsigned char ui_state = UI_STATE_DEFAULT;
-static unsigned char ui_state_runprog = 0;
+static pgid_t ui_state_runprog = 0;
 
 bool ui_confirm(PGM_P str) {
 	os.lcd_print_line_clear_pgm(str, 0);
@@ -247,7 +249,7 @@ void ui_state_machine() {
 			if (button & BUTTON_FLAG_HOLD) {  // holding B1
 				if (digitalReadExt(PIN_BUTTON_3)==0) { // if B3 is pressed while holding B1, run a short test (internal test)
 					if(!ui_confirm(PSTR("Start 2s test?"))) {ui_state = UI_STATE_DEFAULT; break;}
-					manual_start_program(255, 0);
+					manual_start_program(PROGRAM_ID_TEST, 0);
 				} else if (digitalReadExt(PIN_BUTTON_2)==0) { // if B2 is pressed while holding B1, display gateway IP
 					#if defined(USE_SSD1306)
 						os.lcd.setAutoDisplay(false);
@@ -465,7 +467,7 @@ void do_setup() {
 
 	// because at reboot we don't know if special stations
 	// are in OFF state, here we explicitly turn them off
-	for(unsigned char sid=0;sid<os.nstations;sid++) {
+	for(sid_t sid=0;sid<os.nstations;sid++) {
 		os.switch_special_station(sid, 0);
 	}
 
@@ -510,10 +512,13 @@ void do_setup() {
 
 	// because at reboot we don't know if special stations
 	// are in OFF state, here we explicitly turn them off
-	for(unsigned char sid=0;sid<os.nstations;sid++) {
+	for(sid_t sid=0;sid<os.nstations;sid++) {
 		os.switch_special_station(sid, 0);
 	}
 
+	// pick up the runs that were queued before the restart
+	pd.restore_queue(os.now_tz());
+
 	os.mqtt.init();
 	os.status.req_mqtt_restart = true;
 
@@ -522,7 +527,7 @@ void do_setup() {
 
 #endif
 
-void turn_on_station(unsigned char sid, ulong duration);
+void turn_on_station(sid_t sid, ulong duration);
 static void check_network();
 void check_weather();
 static bool process_special_program_command(const char*, uint32_t curr_time);
@@ -554,7 +559,7 @@ void overcurrent_monitor() {
 		if(imax > 0) { // disable overcurrent checking if imax==0
 			imax += OVERCURRENT_INRUSH_EXTRA; // extra margin for inrush current
 			time_os_t tn = os.now_tz();
-			unsigned char sid = curr_alert_sid - 1;
+			sid_t sid = curr_alert_sid - 1;
 			for(unsigned char i = 0; i < 10; i++) {
 				uint16_t curr = os.read_current();
 				if(curr > (uint16_t)imax) {
@@ -573,6 +578,250 @@ void overcurrent_monitor() {
 #endif
 }
 
+#if !defined(ARDUINO)
+/** Millisecond switching
+ * A run with a non-zero dur_ms ends dur_ms milliseconds into its last second.
+ * process_runtime_queue arms the edge at the start of that second, and
+ * process_ms_edges turns the station off on time, with the main loop
+ * woken up by a high-resolution timer
+ */
+static sid_t ms_edge_sids[MAX_NUM_STATIONS]; // stations with an edge armed in the current second
+static sid_t ms_edge_n = 0;
+static time_os_t ms_edge_time = 0;           // the current second, in controller time
+static time_t ms_edge_sec = 0;               // and in wall clock time
+
+static void arm_ms_edge(sid_t sid, time_os_t curr_time) {
+	if (ms_edge_time != curr_time) {
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ms_edge_sec = ts.tv_sec;
+		ms_edge_time = curr_time;
+		ms_edge_n = 0;
+	}
+	if (ms_edge_n < MAX_NUM_STATIONS) ms_edge_sids[ms_edge_n++] = sid;
+}
+
+/** Turn off the stations whose edge has passed, and set a timer for the next one */
+void process_ms_edges() {
+	if (!ms_edge_n) return;
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	long now_ms = (long)(ts.tv_sec-ms_edge_sec)*1000 + ts.tv_nsec/1000000;
+	uint16_t next = 0;
+	bool changed = false;
+	for (sid_t i = 0; i < ms_edge_n; ) {
+		sid_t sid = ms_edge_sids[i];
+		qid_t qid = pd.station_qid[sid];
+		RuntimeQueueStruct *q = (qid!=QID_NONE) ? pd.queue + qid : NULL;
+		if (!q || !os.is_running(sid) || !q->dur_ms || q->st+q->dur-1 != ms_edge_time) {
+			ms_edge_sids[i] = ms_edge_sids[--ms_edge_n]; // turned off or changed in the meantime
+		} else if (now_ms >= q->dur_ms) {
+			turn_off_station(sid, q->st+q->dur);
+			ms_edge_sids[i] = ms_edge_sids[--ms_edge_n];
+			changed = true;
+		} else {
+			if (!next || q->dur_ms < next) next = q->dur_ms;
+			i++;
+		}
+	}
+	if (changed) os.apply_all_station_bits();
+	if (next) event_wake_at(ms_edge_sec + next/1000, (next%1000)*1000000L);
+}
+
+/** Let the web server and its cloud connection wake up the main loop
+ * OTF doesn't expose its sockets, so they are registered as OTF opens them:
+ * the listening socket at start-up, and the cloud connection each time it connects,
+ * found by the OTC server's address and port
+ */
+static void watch_otf_sockets() {
+	static unsigned char tries = 10; // the listening socket may only appear in the first few loops
+	static int cloud = -1;
+	if (tries) tries = (event_watch_sockets(NULL, 0) > 0) ? 0 : tries-1;
+	int status = otf->getCloudStatus();
+	if (status != cloud) {
+		if (status == OTF::CONNECTED) event_watch_sockets(os.otc.server.c_str(), os.otc.port);
+		cloud = status;
+	}
+}
+#endif
+
+/** Run-time keeping of queued stations (called once per second) */
+void process_runtime_queue(time_os_t curr_time) {
+	sid_t sid;
+	RuntimeQueueStruct *q;
+
+	// Check if a program is running currently
+	// If so, do station run-time keeping
+	if (os.status.program_busy){
+		// go through stations that have reached a start, stop or dequeue time
+		// each station's first queue element (by start time) is pd.station_qid[sid]
+		while ((sid=pd.next_due_station(curr_time))!=SID_NONE) {
+			q = pd.queue + pd.station_qid[sid];
+
+			// skip master stations
+			if (os.status.mas != sid+1 && os.status.mas2 != sid+1) {
+				// if current station is not running, check if we should turn it on
+				if(!os.is_running(sid)) {
+					if (curr_time >= q->st && curr_time < q->st+q->dur) {
+						turn_on_station(sid, q->st+q->dur-curr_time); // the last parameter is expected run time
+					} //if curr_time > scheduled_start_time
+				} // if current station is not running
+
+				// check if this station should be turned off
+				if (q->st > 0) {
+					if (curr_time >= q->st+q->dur) {
+						turn_off_station(sid, curr_time);
+					}
+				}
+
+				#if !defined(ARDUINO)
+				// a run that ends within this second: arm its millisecond edge
+				qid_t qid = pd.station_qid[sid];
+				if (qid != QID_NONE) {
+					q = pd.queue + qid;
+					if (q->dur_ms && curr_time == q->st+q->dur-1 && os.is_running(sid)) arm_ms_edge(sid, curr_time);
+				}
+				#endif
+			}
+
+			// finally, clear up elements marked for removal and find the next event
+			pd.update_station(sid, curr_time);
+		}
+
+		// process dynamic events
+		process_dynamic_events(curr_time);
+
+		// activate / deactivate valves
+		os.apply_all_station_bits(overcurrent_monitor);
+
+		// calculate the last stop time of sequential groups that have changed
+		pd.update_seq_stop_times();
+
+		// if the runtime queue is empty
+		// reset all stations
+		if (!pd.nqueue) {
+			// turn off all stations
+			os.clear_all_station_bits();
+			os.apply_all_station_bits();
+			pd.reset_runtime(); // reset runtime
+			os.status.program_busy = 0; // reset program busy bit
+			pd.clear_pause(); // TODO: what if pause hasn't expired and a new program is scheduled to run?
+
+			// log flow sensor reading if flow sensor is used
+			if(os.iopts[IOPT_SENSOR1_TYPE]==SENSOR_TYPE_FLOW) {
+				write_log(LOGDATA_FLOWSENSE, curr_time);
+				notif.add(NOTIFY_FLOWSENSOR, (flow_count>os.flowcount_log_start)?(flow_count-os.flowcount_log_start):0);
+			}
+
+			// in case some options have changed while executing the program
+			os.status.mas = os.iopts[IOPT_MASTER_STATION]; // update master station
+			os.status.mas2= os.iopts[IOPT_MASTER_STATION_2]; // update master2 station
+		}
+	}//if_some_program_is_running
+}
+
+/** Turn master stations on / off based on the stations bound to them */
+void process_master_stations(time_os_t curr_time) {
+	for (unsigned char mas = MASTER_1; mas < NUM_MASTER_ZONES; mas++) {
+		unsigned char mas_id = os.masters[mas][MASOPT_SID];
+		if (mas_id) { // if this master station is set
+			os.set_station_bit(mas_id - 1, pd.master_on(mas, curr_time));
+		}
+	}
+}
+
+/** Check all programs against the minute of match_time
+ * and enqueue the stations of the matching ones
+ * Returns true if any station has been enqueued
+ */
+static bool check_program_schedule(time_os_t match_time, time_os_t curr_time) {
+	unsigned char bid, s;
+	sid_t sid;
+	pgid_t pid;
+	ProgramStruct prog;
+	boolean match_found = false;
+	RuntimeQueueStruct *q;
+
+	// check through all programs: only the schedule part is read,
+	// the rest of a program is loaded once it matches
+	for(pid=0; pid<pd.nprograms; pid++) {
+		pd.read_sched(pid, &prog);
+		bool will_delete = false;
+		unsigned char runcount = prog.check_match(match_time, &will_delete);
+		if(runcount>0) {
+			pd.read(pid, &prog);
+			// program match found
+			// check and process special program command
+			if(process_special_program_command(prog.name, curr_time))	continue;
+
+			// get station ordering
+			sid_t order[os.nstations];
+			prog.gen_station_runorder(runcount, order);
+
+			// prepare watering level
+			unsigned char wl = 100; // default 100%
+			if (prog.use_weather) { 							// if program is set to use weather scaling
+				if (wt_restricted > 0) wl = 0; // if watering restriction is active
+				else {
+					wl = os.iopts[IOPT_WATER_PERCENTAGE];
+					// If historical data is enabled and interval program, overwrite watering percentage with historical one.
+					if (mda == 100 && prog.type == PROGRAM_TYPE_INTERVAL && md_N > 0) {
+						// Use interval length unless longer than available data
+						if ((unsigned int)prog.days[1]-1 < md_N){
+							wl = md_scales[prog.days[1]-1];
+						} else {
+							wl = md_scales[md_N-1];
+						}
+					}
+				}
+			}
+
+			// process all selected stations
+			for(sid_t oi=0;oi<os.nstations;oi++) {
+				sid=order[oi];
+				bid=sid>>3;
+				s=sid&0x07;
+				// skip if the station is a master station (because master cannot be scheduled independently
+				if ((os.status.mas==sid+1) || (os.status.mas2==sid+1))
+					continue;
+
+				// if station has non-zero water time and the station is not disabled
+				if (prog.durations[sid] && !(os.attrib_dis[bid]&(1<<s))) {
+					// water time is scaled by watering percentage
+					ulong water_time = water_time_resolve(prog.durations[sid]);
+
+					water_time = water_time * wl / 100;
+					if (wl < 20 && water_time < 10) { // if water_percentage is less than 20% and water_time is less than 10 seconds, skip watering
+						water_time = 0;
+					}
+
+					if (water_time) {
+						// check if water time is still valid
+						// because it may end up being zero after scaling
+						q = pd.enqueue(sid, water_time, pid+1, curr_time);
+						if (q) {
+							match_found = true;
+						} else {
+							DEBUG_PRINTLN(F("queue is full"));
+						}
+					}// if water_time
+				}// if prog.durations[sid]
+			}// for sid
+			if(match_found) {
+				notif.add(NOTIFY_PROGRAM_SCHED, pid, prog.use_weather?wl:100);
+			} else {
+				// program being skipped e.g. due to 0% watering level
+				notif.add(NOTIFY_PROGRAM_SCHED, pid, -1, wt_restricted);
+			}
+			//delete run-once if on final runtime (stations have already been queued)
+			if(will_delete){
+				pd.del(pid);
+			}
+		}// if check_match
+	}// for pid
+	return match_found;
+}
+
 /** Main Loop */
 void do_loop()
 {
@@ -608,8 +857,10 @@ void do_loop()
 
 	static time_os_t last_time = 0;
 	static ulong last_minute = 0;
+	static ulong held_minute = 0;  // while the clock is behind last_minute: the last minute seen
+	static unsigned char held_minutes = 0; // and how many minutes programs have been held for
 
-	unsigned char bid, sid, s, pid, qid, gid, bitvalue;
+	pgid_t pid;
 	ProgramStruct prog;
 
 	os.status.mas = os.iopts[IOPT_MASTER_STATION];
@@ -760,7 +1011,10 @@ void do_loop()
 	ui_state_machine();
 
 #else // Process Ethernet packets for RPI/LINUX
-	if(otf) otf->loop();
+	if(otf) {
+		otf->loop();
+		watch_otf_sockets();
+	}
 #if defined(USE_DISPLAY)
 	ui_state_machine();
 #endif
@@ -860,249 +1114,72 @@ void do_loop()
 
 		// ====== Schedule program data ======
 		ulong curr_minute = curr_time / 60;
-		boolean match_found = false;
-		RuntimeQueueStruct *q;
 		// since the granularity of start time is minute
 		// we only need to check once every minute
 		if (curr_minute != last_minute) {
-			last_minute = curr_minute;
-
-			apply_monthly_adjustment(curr_time); // check and apply monthly adjustment here, if it's selected
-
-			// check through all programs
-			for(pid=0; pid<pd.nprograms; pid++) {
-				pd.read(pid, &prog);	// todo future: reduce load time
-				bool will_delete = false;
-				unsigned char runcount = prog.check_match(curr_time, &will_delete);
-				if(runcount>0) {
-					// program match found
-					// check and process special program command
-					if(process_special_program_command(prog.name, curr_time))	continue;
-
-					// get station ordering
-					unsigned char order[os.nstations];
-					prog.gen_station_runorder(runcount, order);
-
-					// prepare watering level
-					unsigned char wl = 100; // default 100%
-					if (prog.use_weather) { 							// if program is set to use weather scaling
-						if (wt_restricted > 0) wl = 0; // if watering restriction is active
-						else {
-							wl = os.iopts[IOPT_WATER_PERCENTAGE];
-							// If historical data is enabled and interval program, overwrite watering percentage with historical one.
-							if (mda == 100 && prog.type == PROGRAM_TYPE_INTERVAL && md_N > 0) {
-								// Use interval length unless longer than available data
-								if ((unsigned int)prog.days[1]-1 < md_N){
-									wl = md_scales[prog.days[1]-1];
-								} else {
-									wl = md_scales[md_N-1];
-								}
-							}
-						}
-					}
+			ulong first_minute = curr_minute;
+			if (last_minute && curr_minute > last_minute+1 && curr_minute-last_minute <= CATCHUP_FORWARD_LIMIT) {
+				// minutes have been skipped (the loop stalled or the clock jumped forward)
+				// check each of them once, up to the catch-up window
+				// larger jumps mean the clock has just been set, so there is nothing to catch up
+				ulong window = os.iopts[IOPT_CATCHUP_WINDOW];
+				if (!window) window = DEFAULT_CATCHUP_WINDOW;
+				else if (window == CATCHUP_WINDOW_OFF) window = 0;
+				first_minute = (curr_minute-last_minute-1 < window) ? last_minute+1 : curr_minute-window;
+			}
 
-					// process all selected stations
-					for(unsigned char oi=0;oi<os.nstations;oi++) {
-						sid=order[oi];
-						bid=sid>>3;
-						s=sid&0x07;
-						// skip if the station is a master station (because master cannot be scheduled independently
-						if ((os.status.mas==sid+1) || (os.status.mas2==sid+1))
-							continue;
-
-						// if station has non-zero water time and the station is not disabled
-						if (prog.durations[sid] && !(os.attrib_dis[bid]&(1<<s))) {
-							// water time is scaled by watering percentage
-							ulong water_time = water_time_resolve(prog.durations[sid]);
-
-							water_time = water_time * wl / 100;
-							if (wl < 20 && water_time < 10) { // if water_percentage is less than 20% and water_time is less than 10 seconds, skip watering
-								water_time = 0;
-							}
-
-							if (water_time) {
-								// check if water time is still valid
-								// because it may end up being zero after scaling
-								q = pd.enqueue();
-								if (q) {
-									q->st = 0;
-									q->dur = water_time;
-									q->sid = sid;
-									q->pid = pid+1;
-									match_found = true;
-								} else {
-									// queue is full
-								}
-							}// if water_time
-						}// if prog.durations[sid]
-					}// for sid
-					if(match_found) {
-						notif.add(NOTIFY_PROGRAM_SCHED, pid, prog.use_weather?wl:100);
-					} else {
-						// program being skipped e.g. due to 0% watering level
-						notif.add(NOTIFY_PROGRAM_SCHED, pid, -1, wt_restricted);
-					}
-					//delete run-once if on final runtime (stations have already been queued)
-					if(will_delete){
-						pd.del(pid);
-					}
-				}// if check_match
-			}// for pid
-
-			// calculate start and end time
-			if (match_found) {
-				schedule_all_stations(curr_time);
-
-				// For debugging: print out queued elements
-				/*DEBUG_PRINT("en:");
-				for(q=pd.queue;q<pd.queue+pd.nqueue;q++) {
-					DEBUG_PRINT("[");
-					DEBUG_PRINT(q->sid);
-					DEBUG_PRINT(",");
-					DEBUG_PRINT(q->dur);
-					DEBUG_PRINT(",");
-					DEBUG_PRINT(q->st);
-					DEBUG_PRINT("]");
+			// the clock went back: these minutes have already been checked
+			// so wait until it passes last_minute again, but don't hold programs off for more than the limit
+			bool hold = false;
+			if (last_minute && curr_minute < last_minute) {
+				if (curr_minute != held_minute) {
+					held_minute = curr_minute;
+					held_minutes++;
 				}
-				DEBUG_PRINTLN("");*/
+				hold = (held_minutes <= CATCHUP_BACKWARD_LIMIT);
+			} else {
+				held_minutes = 0;
 			}
-		}//if_check_current_minute
 
-		// ====== Run program data ======
-		// Check if a program is running currently
-		// If so, do station run-time keeping
-		if (os.status.program_busy){
-			// first, go through run time queue to assign queue elements to stations
-			q = pd.queue;
-			qid=0;
-			for(;q<pd.queue+pd.nqueue;q++,qid++) {
-				sid=q->sid;
-				unsigned char sqi=pd.station_qid[sid];
-				// skip if station is already assigned a queue element
-				// and that queue element has an earlier start time
-				if(sqi<255 && pd.queue[sqi].st<q->st) continue;
-				// otherwise assign the queue element to station
-				pd.station_qid[sid]=qid;
-			}
-			// next, go through the stations and perform time keeping
-			for(bid=0;bid<os.nboards; bid++) {
-				bitvalue = os.station_bits[bid];
-				for(s=0;s<8;s++) {
-					unsigned char sid = bid*8+s;
-
-					// skip master stations and any station that's not in the queue
-					if (os.status.mas == sid+1) continue;
-					if (os.status.mas2== sid+1) continue;
-					if (pd.station_qid[sid]==255) continue;
-
-					q = pd.queue + pd.station_qid[sid];
-
-					// if current station is not running, check if we should turn it on
-					if(!((bitvalue >> s) & 1)) {
-						if (curr_time >= q->st && curr_time < q->st+q->dur) {
-							turn_on_station(sid, q->st+q->dur-curr_time); // the last parameter is expected run time
-						} //if curr_time > scheduled_start_time
-					} // if current station is not running
-
-					// check if this station should be turned off
-					if (q->st > 0) {
-						if (curr_time >= q->st+q->dur) {
-							turn_off_station(sid, curr_time);
-						}
+			if (!hold) {
+				last_minute = curr_minute;
+
+				apply_monthly_adjustment(curr_time); // check and apply monthly adjustment here, if it's selected
+
+				boolean match_found = false;
+				for(ulong m=first_minute; m<=curr_minute; m++) {
+					if (m != curr_minute) {
+						DEBUG_PRINT(F("catching up minute "));
+						DEBUG_PRINTLN(m);
 					}
-				}//end_s
-			}//end_bid
-
-			// finally, go through the queue again and clear up elements marked for removal
-			int qi;
-			for(qi=pd.nqueue-1;qi>=0;qi--) {
-				q=pd.queue+qi;
-				if(!q->dur || curr_time >= q->deque_time) {
-					pd.dequeue(qi);
+					if (check_program_schedule((m==curr_minute) ? curr_time : (time_os_t)m*60, curr_time)) match_found = true;
 				}
-			}
 
-			// process dynamic events
-			process_dynamic_events(curr_time);
-
-			// activate / deactivate valves
-			os.apply_all_station_bits(overcurrent_monitor);
-
-			// check through runtime queue, calculate the last stop time of sequential stations
-			memset(pd.last_seq_stop_times, 0, sizeof(ulong)*NUM_SEQ_GROUPS);
-			time_os_t sst;
-			unsigned char re=os.iopts[IOPT_REMOTE_EXT_MODE];
-			q = pd.queue;
-			for(;q<pd.queue+pd.nqueue;q++) {
-				sid = q->sid;
-				bid = sid>>3;
-				s = sid&0x07;
-				gid = os.get_station_gid(sid);
-				// check if any sequential station has a valid stop time
-				// and the stop time must be larger than curr_time
-				sst = q->st + q->dur;
-				if (sst>curr_time) {
-					// only need to update last_seq_stop_time for sequential stations
-					if (os.is_sequential_station(sid) && !re) {
-						pd.last_seq_stop_times[gid] = (sst > pd.last_seq_stop_times[gid]) ? sst : pd.last_seq_stop_times[gid];
+				// calculate start and end time
+				if (match_found) {
+					schedule_all_stations(curr_time);
+
+					// For debugging: print out queued elements
+					/*DEBUG_PRINT("en:");
+					for(RuntimeQueueStruct *q=pd.queue;q<pd.queue+pd.nqueue;q++) {
+						DEBUG_PRINT("[");
+						DEBUG_PRINT(q->sid);
+						DEBUG_PRINT(",");
+						DEBUG_PRINT(q->dur);
+						DEBUG_PRINT(",");
+						DEBUG_PRINT(q->st);
+						DEBUG_PRINT("]");
 					}
+					DEBUG_PRINTLN("");*/
 				}
 			}
+		}//if_check_current_minute
 
-			// if the runtime queue is empty
-			// reset all stations
-			if (!pd.nqueue) {
-				// turn off all stations
-				os.clear_all_station_bits();
-				os.apply_all_station_bits();
-				pd.reset_runtime(); // reset runtime
-				os.status.program_busy = 0; // reset program busy bit
-				pd.clear_pause(); // TODO: what if pause hasn't expired and a new program is scheduled to run?
-
-				// log flow sensor reading if flow sensor is used
-				if(os.iopts[IOPT_SENSOR1_TYPE]==SENSOR_TYPE_FLOW) {
-					write_log(LOGDATA_FLOWSENSE, curr_time);
-					notif.add(NOTIFY_FLOWSENSOR, (flow_count>os.flowcount_log_start)?(flow_count-os.flowcount_log_start):0);
-				}
-
-				// in case some options have changed while executing the program
-				os.status.mas = os.iopts[IOPT_MASTER_STATION]; // update master station
-				os.status.mas2= os.iopts[IOPT_MASTER_STATION_2]; // update master2 station
-			}
-		}//if_some_program_is_running
+		// ====== Run program data ======
+		process_runtime_queue(curr_time);
 
 		// handle master
-		for (unsigned char mas = MASTER_1; mas < NUM_MASTER_ZONES; mas++) {
-
-			unsigned char mas_id = os.masters[mas][MASOPT_SID];
-
-			if (mas_id) { // if this master station is set
-				int16_t mas_on_adj = os.get_on_adj(mas);
-				int16_t mas_off_adj = os.get_off_adj(mas);
-
-				unsigned char masbit = 0;
-
-				for(sid = 0; sid < os.nstations; sid++) {
-					// skip if this is the master station
-					if (mas_id == sid + 1) continue;
-
-					if(pd.station_qid[sid]==255) continue; // skip if station is not in the queue
-
-					q = pd.queue + pd.station_qid[sid];
-
-					if (os.bound_to_master(q->sid, mas)) {
-						// check if timing is within the acceptable range
-						if (curr_time >= q->st + mas_on_adj &&
-							curr_time <= q->st + q->dur + mas_off_adj) {
-							masbit = 1;
-							break;
-						}
-					}
-				}
-
-				os.set_station_bit(mas_id - 1, masbit);
-			}
-		}
+		process_master_stations(curr_time);
 
 		if (os.status.pause_state) {
 			if (os.pause_timer > 0) {
@@ -1135,6 +1212,11 @@ void do_loop()
 		// activate/deactivate valves
 		os.apply_all_station_bits(overcurrent_monitor);
 
+#if !defined(ARDUINO)
+		// keep the queue snapshot up to date, so runs survive a restart
+		pd.save_queue(curr_time);
+#endif
+
 #if defined(USE_DISPLAY)
 		// process LCD display
 		if (!ui_state) { os.lcd_print_screen(ui_anim_chars[(unsigned long)curr_time%3]); }
@@ -1149,7 +1231,7 @@ void do_loop()
 				bool willrun = false;
 				bool will_delete = false;
 				for(pid=0; pid<pd.nprograms; pid++) {
-					pd.read(pid, &prog);
+					pd.read_sched(pid, &prog);
 					if(prog.check_match(curr_time+60, &will_delete)) {
 						willrun = true;
 						break;
@@ -1196,7 +1278,21 @@ void do_loop()
 	}
 
 	#if !defined(ARDUINO)
-		delay(1); // For OSPI/LINUX, sleep 1 ms to minimize CPU usage
+		process_ms_edges();
+		os.process_special_results();
+
+		// For OSPI/LINUX, sleep until there is something to do to minimize CPU usage
+		ulong wait_ms = 1000; // the loop is also woken up at the start of each second
+		#if defined(USE_DISPLAY)
+		wait_ms = UI_STATE_MACHINE_INTERVAL; // buttons are polled
+		#endif
+		if(os.iopts[IOPT_SENSOR1_TYPE]==SENSOR_TYPE_FLOW) {
+			// wake up on flow sensor pulses, or keep polling if edge events are not available
+			static int flow_fd = -2;
+			if(flow_fd == -2) flow_fd = event_watch(gpio_edge_fd(PIN_SENSOR1));
+			if(flow_fd < 0) wait_ms = FLOWPOLL_INTERVAL;
+		}
+		wait_for_events(wait_ms);
 	#endif
 }
 
@@ -1257,7 +1353,7 @@ void check_weather() {
 /** Turn on a station
  * This function turns on a scheduled station
  */
-void turn_on_station(unsigned char sid, ulong duration) {
+void turn_on_station(sid_t sid, ulong duration) {
 	// RAH implementation of flow sensor
 	flow_start=0;
 	//Added flow_gallons reset to station turn on.
@@ -1270,23 +1366,24 @@ void turn_on_station(unsigned char sid, ulong duration) {
 
 // after removing element q, update remaining stations in its group
 void handle_shift_remaining_stations(RuntimeQueueStruct* q, unsigned char gid, time_os_t curr_time) {
-	RuntimeQueueStruct *s = pd.queue;
+	RuntimeQueueStruct *s;
 	time_os_t q_end_time = q->st + q->dur;
 	ulong remainder = 0;
 
 	if (q_end_time > curr_time) { // remainder is non-zero
 		remainder = (q->st < curr_time) ? q_end_time - curr_time : q->dur;
-		for ( ; s < pd.queue + pd.nqueue; s++) {
+		// only stations in the same group need to be checked
+		for (qid_t qid = pd.group_qid[gid]; qid != QID_NONE; qid = s->gnext) {
+			s = pd.queue + qid;
 
-			// ignore station to be removed and stations in other groups
-			if (s == q || os.get_station_gid(s->sid) != gid || !os.is_sequential_station(s->sid)) {
-				continue;
-			}
+			// ignore station to be removed
+			if (s == q) continue;
 
 			// only shift stations following current station
 			if (s->st >= q_end_time) {
 				s->st -= remainder;
 				s->deque_time -= remainder;
+				pd.touch_station(s->sid);
 			}
 		}
 	}
@@ -1299,11 +1396,11 @@ void handle_shift_remaining_stations(RuntimeQueueStruct* q, unsigned char gid, t
  * and this function does not perform logging, current detection, or notifications
  * Meant to be called in overcurrent situations to turn off a running zone right away
  */
-void turn_off_running_station_immediate(unsigned char sid, time_os_t curr_time, unsigned char shift) {
+void turn_off_running_station_immediate(sid_t sid, time_os_t curr_time, unsigned char shift) {
 	os.set_station_bit(sid, 0);
 	os.apply_all_station_bits();
 
-	unsigned char qid = pd.station_qid[sid];
+	qid_t qid = pd.station_qid[sid];
 	RuntimeQueueStruct *q = pd.queue + qid;
 	unsigned char gid = os.get_station_gid(q->sid);
 
@@ -1312,11 +1409,10 @@ void turn_off_running_station_immediate(unsigned char sid, time_os_t curr_time,
 	}
 
 	int16_t station_delay = water_time_decode_signed(os.iopts[IOPT_STATION_DELAY_TIME]);
-	if (q->st + q->dur + station_delay == pd.last_seq_stop_times[gid]) { // if removing last station in group
+	if (gid < MAX_SEQ_GROUPS && q->st + q->dur + station_delay == pd.last_seq_stop_times[gid]) { // if removing last station in group
 		pd.last_seq_stop_times[gid] = 0;
 	}
 	pd.dequeue(qid);
-	pd.station_qid[sid] = 0xFF;
 }
 
 /** Turn off a station
@@ -1324,9 +1420,9 @@ void turn_off_running_station_immediate(unsigned char sid, time_os_t curr_time,
  * writes a log record and determines if
  * the station should be removed from the queue
  */
-void turn_off_station(unsigned char sid, time_os_t curr_time, unsigned char shift) {
+void turn_off_station(sid_t sid, time_os_t curr_time, unsigned char shift) {
 
-	unsigned char qid = pd.station_qid[sid];
+	qid_t qid = pd.station_qid[sid];
 	// ignore request if trying to turn off a zone that's not even in the queue
 	if (qid >= pd.nqueue)  {
 		return;
@@ -1345,13 +1441,18 @@ void turn_off_station(unsigned char sid, time_os_t curr_time, unsigned char shif
 			force_dequeue = 1;
 		} else { // if already off just remove from the queue
 			pd.dequeue(qid);
-			pd.station_qid[sid] = 0xFF;
 			return;
 		}
 	} else if (curr_time >= q->st + q->dur) { // end time and dequeue time are not equal due to master handling
 		if (!station_bit) { return; }
 	} //else { return; }
 
+	// a station is measured only if no other (non-master) station was running with it
+	bool alone = station_bit && !os.is_master_station(sid);
+	for (RuntimeQueueStruct *p = pd.queue; alone && p < pd.queue+pd.nqueue; p++) {
+		if (p!=q && os.is_running(p->sid) && !os.is_master_station(p->sid)) alone = false;
+	}
+
 	#if defined(ARDUINO)
 	int16_t current = (int16_t)os.read_current();
 	int16_t imin = os.get_imin();
@@ -1360,6 +1461,11 @@ void turn_off_station(unsigned char sid, time_os_t curr_time, unsigned char shif
 	if((current < imin) && (os.hw_type==HW_TYPE_AC || os.hw_type==HW_TYPE_DC)) {
 		notif.add(NOTIFY_CURR_ALERT, sid, current, CURR_ALERT_TYPE_UNDER);
 	}
+	// learn the station's steady-state current, once it's past the inrush
+	if (alone && current > (int16_t)os.baseline_current && curr_time > q->st + 2 &&
+	    (os.hw_type==HW_TYPE_AC || os.hw_type==HW_TYPE_DC) && !(os.attrib_spe[sid>>3]&(1<<(sid&0x07)))) {
+		os.learn_station_current(sid, current - os.baseline_current);
+	}
 	#endif
 
 	os.set_station_bit(sid, 0);
@@ -1371,6 +1477,13 @@ void turn_off_station(unsigned char sid, time_os_t curr_time, unsigned char shif
 	}// RAH calculate GPM, 1 pulse per gallon
 	else {flow_last_gpm = 0;}  // RAH if not one gallon (two pulses) measured then record 0 gpm
 
+	// learn the station's nominal flow rate
+	if (alone && flow_last_gpm > 0 && os.iopts[IOPT_SENSOR1_TYPE]==SENSOR_TYPE_FLOW) {
+		uint32_t flowrate100 = (((uint32_t)os.iopts[IOPT_PULSE_RATE_1])<<8) + os.iopts[IOPT_PULSE_RATE_0];
+		float flow = flow_last_gpm * flowrate100;
+		os.learn_station_flow(sid, (flow < STATION_FLOW_FIXED) ? (uint16_t)flow : STATION_FLOW_FIXED-1);
+	}
+
 	// check if the current time is past the scheduled start time,
 	// because we may be turning off a station that hasn't started yet
 	if (curr_time >= q->st) {
@@ -1390,13 +1503,14 @@ void turn_off_station(unsigned char sid, time_os_t curr_time, unsigned char shif
 
 	// make necessary adjustments to sequential time stamps
 	int16_t station_delay = water_time_decode_signed(os.iopts[IOPT_STATION_DELAY_TIME]);
-	if (q->st + q->dur + station_delay == pd.last_seq_stop_times[gid]) { // if removing last station in group
+	if (gid < MAX_SEQ_GROUPS && q->st + q->dur + station_delay == pd.last_seq_stop_times[gid]) { // if removing last station in group
 		pd.last_seq_stop_times[gid] = 0;
 	}
 
 	if (force_dequeue) {
 		pd.dequeue(qid);
-		pd.station_qid[sid] = 0xFF;
+	} else {
+		pd.touch_station(sid);
 	}
 }
 
@@ -1419,31 +1533,33 @@ void process_dynamic_events(time_os_t curr_time) {
 		 && os.status.sensor2_active)
 		sn2 = true;
 
-	unsigned char sid, s, bid, qid, igs, igs2, igrd;
-	for(bid=0;bid<os.nboards;bid++) {
-		igs = os.attrib_igs[bid];
-		igs2= os.attrib_igs2[bid];
-		igrd= os.attrib_igrd[bid];
-
-		for(s=0;s<8;s++) {
-			sid=bid*8+s;
-
-			// ignore master stations because they are handled separately
-			if (os.status.mas == sid+1) continue;
-			if (os.status.mas2== sid+1) continue;
-			// If this is a normal program (not a run-once or test program)
-			// and either the controller is disabled, or
-			// if raining and ignore rain bit is cleared
-			// FIX ME
-			qid = pd.station_qid[sid];
-			if(qid==255) continue;
-			RuntimeQueueStruct *q = pd.queue + qid;
-
-			if(q->pid>=99) continue;  // if this is a manually started program, proceed
-			if(!en)	{q->deque_time=curr_time; turn_off_station(sid, curr_time);}  // if system is disabled, turn off zone
-			if(rd && !(igrd&(1<<s))) {q->deque_time=curr_time; turn_off_station(sid, curr_time);}  // if rain delay is on and zone does not ignore rain delay, turn it off
-			if(sn1&& !(igs &(1<<s))) {q->deque_time=curr_time; turn_off_station(sid, curr_time);}  // if sensor1 is on and zone does not ignore sensor1, turn it off
-			if(sn2&& !(igs2&(1<<s))) {q->deque_time=curr_time; turn_off_station(sid, curr_time);}  // if sensor2 is on and zone does not ignore sensor2, turn it off
+	// nothing to turn off unless one of the conditions is present
+	if(en && !rd && !sn1 && !sn2) return;
+
+	sid_t sid, i, n;
+	unsigned char s, bid;
+	sid_t active[MAX_NUM_STATIONS];
+	n = pd.get_active_stations(active);
+	for(i=0;i<n;i++) {
+		sid=active[i];
+		bid=sid>>3;
+		s=sid&0x07;
+
+		// ignore master stations because they are handled separately
+		if (os.status.mas == sid+1) continue;
+		if (os.status.mas2== sid+1) continue;
+		// If this is a normal program (not a run-once or test program)
+		// and either the controller is disabled, or
+		// if raining and ignore rain bit is cleared
+		RuntimeQueueStruct *q = pd.queue + pd.station_qid[sid];
+
+		if(q->pid>=PROGRAM_ID_MANUAL) continue;  // if this is a manually started program, proceed
+		if(!en // if system is disabled, turn off zone
+		 || (rd && !(os.attrib_igrd[bid]&(1<<s))) // if rain delay is on and zone does not ignore rain delay, turn it off
+		 || (sn1&& !(os.attrib_igs[bid] &(1<<s))) // if sensor1 is on and zone does not ignore sensor1, turn it off
+		 || (sn2&& !(os.attrib_igs2[bid]&(1<<s)))) { // if sensor2 is on and zone does not ignore sensor2, turn it off
+			q->deque_time=curr_time;
+			turn_off_station(sid, curr_time);
 		}
 	}
 }
@@ -1475,12 +1591,114 @@ void handle_master_adjustments(time_os_t curr_time, RuntimeQueueStruct *q, unsig
 	// push back station's start time to allow sufficient time to turn on master
 	if (q->st - curr_time <= abs(start_adj)) {
 		q->st += abs(start_adj);
-		seq_start_times[gid] += abs(start_adj);
+		if (gid < MAX_SEQ_GROUPS) seq_start_times[gid] += abs(start_adj);
 	}
 
 	q->deque_time = q->st + q->dur + dequeue_adj;
 }
 
+#define LIMIT_CURRENT NUM_MASTER_ZONES // index of the current budget, after the flow capacity of each master
+#define NUM_LIMITS    (NUM_MASTER_ZONES+1)
+
+/** Load a station puts on limit r: its flow if it's bound to master r, or its current */
+static uint32_t station_load(sid_t sid, unsigned char r) {
+	if (r == LIMIT_CURRENT) return os.get_station_current(sid);
+	return os.bound_to_master(sid, r) ? os.get_station_flow(sid) : 0;
+}
+
+#if defined(LARGE_INSTALL)
+static qid_t *fit_starts = NULL, *fit_ends = NULL; // scratch for fit_limits, grown with the queue
+static qid_t fit_size = 0;
+#else
+static qid_t fit_starts[RUNTIME_QUEUE_SIZE], fit_ends[RUNTIME_QUEUE_SIZE];
+#endif
+
+static time_os_t queue_end(qid_t i) { return pd.queue[i].st + pd.queue[i].dur; }
+
+static int by_start(const void *a, const void *b) {
+	time_os_t x = pd.queue[*(const qid_t*)a].st, y = pd.queue[*(const qid_t*)b].st;
+	return (x > y) - (x < y);
+}
+
+static int by_end(const void *a, const void *b) {
+	time_os_t x = queue_end(*(const qid_t*)a), y = queue_end(*(const qid_t*)b);
+	return (x > y) - (x < y);
+}
+
+/** Find the earliest start time (no earlier than t0) at which q can run
+ * for its whole duration without exceeding the flow capacity of its masters
+ * or the controller's current budget, given the stations that are already scheduled
+ */
+static time_os_t fit_limits(RuntimeQueueStruct *q, time_os_t t0) {
+	uint32_t need[NUM_LIMITS], cap[NUM_LIMITS], load[NUM_LIMITS];
+	bool limited = false;
+	unsigned char r;
+	for (r = 0; r < NUM_LIMITS; r++) {
+		need[r] = station_load(q->sid, r);
+		if (r == LIMIT_CURRENT) cap[r] = need[r] ? os.get_current_budget() : 0;
+		else cap[r] = (need[r] && os.get_master_id(r)) ? os.get_master_capacity(r) : 0;
+		if (cap[r]) {
+			if (need[r] > cap[r]) need[r] = cap[r]; // a station larger than the limit runs on its own
+			limited = true;
+		}
+		load[r] = 0;
+	}
+	if (!limited) return t0;
+
+#if defined(LARGE_INSTALL)
+	if (fit_size < pd.queue_size) {
+		qid_t *fs = (qid_t*)realloc(fit_starts, pd.queue_size*sizeof(qid_t));
+		if (fs) fit_starts = fs;
+		qid_t *fe = (qid_t*)realloc(fit_ends, pd.queue_size*sizeof(qid_t));
+		if (fe) fit_ends = fe;
+		if (!fs || !fe) {
+			DEBUG_PRINTLN(F("out of memory for scheduling, flow and current limits not applied"));
+			return t0; // better to run without the limits than not to run at all
+		}
+		fit_size = pd.queue_size;
+	}
+#endif
+	// the scheduled stations that add to one of q's limits and haven't ended by t0,
+	// ordered by start and by end time
+	qid_t n = 0;
+	RuntimeQueueStruct *s;
+	for (s = pd.queue; s < pd.queue+pd.nqueue; s++) {
+		if (s==q || !s->st || !s->dur || s->st+s->dur<=t0) continue;
+		for (r = 0; r < NUM_LIMITS; r++) {
+			if (cap[r] && station_load(s->sid, r)) break;
+		}
+		if (r == NUM_LIMITS) continue;
+		fit_starts[n] = fit_ends[n] = s - pd.queue;
+		n++;
+	}
+	qsort(fit_starts, n, sizeof(qid_t), by_start);
+	qsort(fit_ends, n, sizeof(qid_t), by_end);
+
+	// sweep the load from t0 on, segment by segment (the load only changes where a station starts or ends)
+	// a segment that would exceed a limit can't be part of q's run, so q has to start after it
+	time_os_t t = t0, x = t0, next;
+	qid_t i = 0, j = 0;
+	bool exceeded;
+	while (true) {
+		for (; i < n && pd.queue[fit_starts[i]].st <= x; i++) {
+			for (r = 0; r < NUM_LIMITS; r++) if (cap[r]) load[r] += station_load(pd.queue[fit_starts[i]].sid, r);
+		}
+		for (; j < n && queue_end(fit_ends[j]) <= x; j++) {
+			for (r = 0; r < NUM_LIMITS; r++) if (cap[r]) load[r] -= station_load(pd.queue[fit_ends[j]].sid, r);
+		}
+		exceeded = false;
+		for (r = 0; r < NUM_LIMITS; r++) {
+			if (cap[r] && load[r]+need[r] > cap[r]) exceeded = true;
+		}
+		if (j == n) return t; // nothing running from x on (an exceeded segment always has a station to end)
+		next = queue_end(fit_ends[j]);
+		if (i < n && pd.queue[fit_starts[i]].st < next) next = pd.queue[fit_starts[i]].st;
+		if (exceeded) t = next;
+		else if (next >= t+q->dur) return t;
+		x = next;
+	}
+}
+
 /** Scheduler
  * This function loops through the queue
  * and schedules the start time of each station
@@ -1495,48 +1713,58 @@ void schedule_all_stations(time_os_t curr_time) {
 
 	RuntimeQueueStruct *q = NULL;
 	unsigned char gid;
-	unsigned char stagger[NUM_SEQ_GROUPS]; // different sequential groups will be staggered by 1 second from each other
-	memset(stagger, 0, NUM_SEQ_GROUPS);
+	unsigned char nsg = os.get_num_seq_groups();
+	unsigned char stagger[MAX_SEQ_GROUPS]; // different sequential groups will be staggered by 1 second from each other
+	memset(stagger, 0, nsg);
 	// go through the queue and see if there is any scheduled zone for each sequential group
 	for(q=pd.queue;q<pd.queue+pd.nqueue;q++) {
 		if(q->st || (!q->dur)) continue; // if this element already has a start time or is marked for reset, skip
+		if(!os.is_sequential_station(q->sid)) continue; // parallel stations have no group state
 		gid = os.get_station_gid(q->sid);
 		stagger[gid] = 1; // mark this group
 	}
-	for(unsigned char i=1;i<NUM_SEQ_GROUPS;i++) {
+	for(unsigned char i=1;i<nsg;i++) {
 		stagger[i] += stagger[i-1]; // accumulate stagger time
 	}
-	ulong seq_start_times[NUM_SEQ_GROUPS];  // sequential start times
-	for(unsigned char i=0;i<NUM_SEQ_GROUPS;i++) {
+	ulong seq_start_times[MAX_SEQ_GROUPS];  // sequential start times
+	for(unsigned char i=0;i<nsg;i++) {
 		seq_start_times[i] = con_start_time+stagger[i];
 		// if the sequential queue already has stations running
 		if (pd.last_seq_stop_times[i] > curr_time) {
 			seq_start_times[i] = pd.last_seq_stop_times[i] + station_delay;
 		}
 	}
-	con_start_time += (stagger[NUM_SEQ_GROUPS-1] + 1); // shift con_start_time to be 1 second after accumulated stagger time
+	con_start_time += (stagger[nsg-1] + 1); // shift con_start_time to be 1 second after accumulated stagger time
 
 	unsigned char re = os.iopts[IOPT_REMOTE_EXT_MODE];
 	// go through runtime queue and calculate start time of each station
 	for(q=pd.queue;q<pd.queue+pd.nqueue;q++) {
 		if(q->st) continue; // if this queue element has already been scheduled, skip
-		if(!q->dur) continue; // if the element has been marked to reset, skip
+		if(!q->dur) { // if the element has been marked to reset, link it so it gets dequeued
+			pd.link(q-pd.queue);
+			continue;
+		}
 		gid = os.get_station_gid(q->sid);
 
 		// use sequential scheduling per sequential group
 		// apply station delay time
-		if (os.is_sequential_station(q->sid) && !re) {
-			q->st = seq_start_times[gid];
-			seq_start_times[gid] += q->dur;
+		// either way, delay the start if the masters' flow capacity or the current budget would be exceeded
+		// the limits are fitted after the master adjustments, which can push the start back
+		bool seq = os.is_sequential_station(q->sid) && !re;
+		q->st = seq ? seq_start_times[gid] : con_start_time;
+		handle_master_adjustments(curr_time, q, gid, seq_start_times);
+		time_os_t st = fit_limits(q, q->st);
+		q->deque_time += st - q->st;
+		q->st = st;
+		if (seq) {
+			seq_start_times[gid] = q->st + q->dur;
 			seq_start_times[gid] += station_delay; // add station delay time
 		} else {
 			// otherwise, concurrent scheduling
-			q->st = con_start_time;
 			// stagger concurrent stations by 1 second
 			con_start_time+=1;
 		}
-
-		handle_master_adjustments(curr_time, q, gid, seq_start_times);
+		pd.link(q-pd.queue);
 
 		if (!os.status.program_busy) {
 			os.status.program_busy = 1;  // set program busy bit
@@ -1560,7 +1788,7 @@ void reset_all_stations_immediate(bool running_ones_only) {
 		time_os_t currtime = os.now_tz();
 		// first round, quickly turn off the zones and mark them for dequeue
 		for(q=pd.queue;q<pd.queue+pd.nqueue;q++) {
-			unsigned char sid = q->sid;
+			sid_t sid = q->sid;
 			if(os.is_running(sid)) { // only turn off running stations
 				q->deque_time = currtime;
 				os.set_station_bit(sid, 0);
@@ -1604,30 +1832,32 @@ void reset_all_stations(bool running_ones_only) {
 		RuntimeQueueStruct *q;
 		for(q=pd.queue;q<pd.queue+pd.nqueue;q++) {
 			q->dur = 0;
+			pd.touch_station(q->sid);
 		}
 	}
 }
 
 /** Manually start a program
  * If pid==0, this is a test program (1 minute per station)
- * If pid==255, this is a short test program (2 second per station)
+ * If pid==PROGRAM_ID_TEST, this is a short test program (2 second per station)
  * If pid > 0. run program pid-1
  */
-void manual_start_program(unsigned char pid, unsigned char uwt) {
+void manual_start_program(pgid_t pid, unsigned char uwt) {
 	boolean match_found = false;
 	reset_all_stations_immediate();
 	ProgramStruct prog;
 	ulong dur;
-	unsigned char sid, bid, s;
-	unsigned char ns = os.nstations;
-	unsigned char order[ns];
+	sid_t sid;
+	unsigned char bid, s;
+	sid_t ns = os.nstations;
+	sid_t order[ns];
 	// prefill with default order: ascending by index
 	for(sid=0;sid<ns;sid++) {
 		order[sid] = sid;
 	}
 
 	unsigned char wl = 100;
-	if ((pid>0)&&(pid<255)) {
+	if ((pid>0)&&(pid<PROGRAM_ID_TEST)) {
 		pd.read(pid-1, &prog);
 		if(uwt) wl = os.iopts[IOPT_WATER_PERCENTAGE];
 		notif.add(NOTIFY_PROGRAM_SCHED, pid-1, wl, 1);
@@ -1635,7 +1865,7 @@ void manual_start_program(unsigned char pid, unsigned char uwt) {
 		prog.gen_station_runorder(1, order);
 	}
 
-	for(unsigned char oi=0;oi<ns;oi++) {
+	for(sid_t oi=0;oi<ns;oi++) {
 		sid=order[oi];
 		bid=sid>>3;
 		s=sid&0x07;
@@ -1643,7 +1873,7 @@ void manual_start_program(unsigned char pid, unsigned char uwt) {
 		if ((os.status.mas==sid+1) || (os.status.mas2==sid+1))
 			continue;
 		dur = 60;
-		if(pid==255)  dur=2;
+		if(pid==PROGRAM_ID_TEST)  dur=2;
 		else if(pid>0)
 			dur = water_time_resolve(prog.durations[sid]);
 		dur = dur * wl / 100;
@@ -1653,7 +1883,7 @@ void manual_start_program(unsigned char pid, unsigned char uwt) {
 				q->st = 0;
 				q->dur = dur;
 				q->sid = sid;
-				q->pid = 254;
+				q->pid = PROGRAM_ID_RUNONCE;
 				match_found = true;
 			}
 		}
@@ -1766,7 +1996,7 @@ void write_log(unsigned char type, time_os_t curr_time) {
 
 	if(type == LOGDATA_STATION) {
 		size_t size = strlen(tmp_buffer);
-		snprintf(tmp_buffer + size, TMP_BUFFER_SIZE - size , "%d", pd.lastrun.program);
+		snprintf(tmp_buffer + size, TMP_BUFFER_SIZE - size , "%d", wire_pid(pd.lastrun.program));
 		strcat_P(tmp_buffer, PSTR(","));
 		size = strlen(tmp_buffer);
 		snprintf(tmp_buffer + size, TMP_BUFFER_SIZE - size , "%d", pd.lastrun.station);
@@ -1994,18 +2224,21 @@ static void perform_ntp_sync() {
 #endif
 }
 
-#if !defined(ARDUINO) // main function for RPI/LINUX
+#if !defined(ARDUINO) && !defined(OS_BENCHMARK) // main function for RPI/LINUX
 int main(int argc, char *argv[]) {
 	// Disable buffering to work with systemctl journal
 	setvbuf(stdout, NULL, _IOLBF, 0);
 	printf("Starting OpenSprinkler\n");
 
 	int opt;
-	while(-1 != (opt = getopt(argc, argv, "d:"))) {
+	while(-1 != (opt = getopt(argc, argv, "d:g:"))) {
 		switch(opt) {
 		case 'd':
 			set_data_dir(optarg);
 			break;
+		case 'g': // gpio backend: gpiod or sim
+			if(!gpio_select_backend(optarg)) printf("Unknown gpio backend %s\n", optarg);
+			break;
 		default:
 			// ignore options we don't understand
 			break;
@@ -27,10 +27,15 @@
 #ifndef _MAIN_H
 #define _MAIN_H 1
 
-void turn_off_station(unsigned char sid, time_os_t curr_time, unsigned char shift=0);
-void turn_off_running_station_immediate(unsigned char sid, time_os_t curr_time, unsigned char shift=0);
+void turn_off_station(sid_t sid, time_os_t curr_time, unsigned char shift=0);
+void turn_off_running_station_immediate(sid_t sid, time_os_t curr_time, unsigned char shift=0);
 void schedule_all_stations(time_os_t curr_time);
+void process_runtime_queue(time_os_t curr_time);
+void process_master_stations(time_os_t curr_time);
 void process_dynamic_events(time_os_t curr_time);
+#if !defined(ARDUINO)
+void process_ms_edges();
+#endif
 void reset_all_stations(bool running_ones_only=false);
 void reset_all_stations_immediate(bool running_ones_only=false);
 void delete_log(char *name);
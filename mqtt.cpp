@@ -181,10 +181,17 @@ void manualRun(char *message){
 	}
 
 	uint16_t timer = 0;
+#if !defined(ARDUINO)
+	uint16_t timer_ms = 0;
+#endif
 	unsigned long curr_time = os.now_tz();
 	if(en){
 		if(findKeyVal(message, tmp_buffer, TMP_BUFFER_SIZE, PSTR("t"), true)){
 			timer = (uint16_t)atol(tmp_buffer);
+#if !defined(ARDUINO)
+			timer_ms = parse_ms_fraction(tmp_buffer); // sub-second runs, e.g. t=0.5
+			if(timer_ms) timer++; // the run ends within its last second
+#endif
 			if(timer==0 || timer>64800){
 				DEBUG_LOGF("Time out of bounds.\r\n");
 				return;
@@ -194,9 +201,9 @@ void manualRun(char *message){
 				return;
 			}
 			RuntimeQueueStruct *q = NULL;
-			unsigned char sqi = pd.station_qid[sid];
+			qid_t sqi = pd.station_qid[sid];
 			//check if station has schedule
-			if(sqi!=0xFF){
+			if(sqi!=QID_NONE){
 				q = pd.queue+sqi;
 			}else{
 				q = pd.enqueue();
@@ -205,8 +212,11 @@ void manualRun(char *message){
 			if(q){
 				q->st = 0;
 				q->dur = timer;
+#if !defined(ARDUINO)
+				q->dur_ms = timer_ms;
+#endif
 				q->sid = sid;
-				q->pid = 99;
+				q->pid = PROGRAM_ID_MANUAL;
 				schedule_all_stations(curr_time);
 			}else{
 				DEBUG_LOGF("Queue is full.\r\n");
@@ -229,7 +239,7 @@ void manualRun(char *message){
 }
 
 //handles /mp command
-void manual_start_program(unsigned char, unsigned char);
+void manual_start_program(pgid_t, unsigned char);
 void programStart(char *message){
 	if(!findKeyVal(message, tmp_buffer, TMP_BUFFER_SIZE, PSTR("pid"), true)){
 		DEBUG_LOGF("Program ID missing.\r\n")
@@ -270,7 +280,8 @@ void runOnceProgram(char *message){
 
 	reset_all_stations_immediate();
 
-	unsigned char sid, bid, s;
+	sid_t sid;
+	unsigned char bid, s;
 	uint16_t dur;
 	boolean match_found = false;
 	for(sid = 0; sid < os.nstations; sid++){
@@ -283,7 +294,7 @@ void runOnceProgram(char *message){
 			if(q){
 				q->st = 0;
 				q->dur = water_time_resolve(dur);
-				q->pid = 254;
+				q->pid = PROGRAM_ID_RUNONCE;
 				q->sid = sid;
 				match_found = true;
 			}
@@ -664,6 +675,7 @@ int OSMqtt::_connect(void) {
 		DEBUG_LOGF("MQTT Connect: Connection Failed (%s)\r\n", mosquitto_strerror(rc));
 		return MQTT_ERROR;
 	}
+	event_watch_socket(mosquitto_socket(mqtt_client)); // wake up the main loop for incoming messages
 
 	// Allow 10ms for the Broker's ack to be received. We need this on start-up so that the
 	// connection is registered before we attempt to send our first NOTIFY_REBOOT notification.
@@ -446,8 +446,26 @@ void server_json_stations_main(OTF_PARAMS_DEF) {
 	server_json_board_attrib(PSTR("stn_spe"), os.attrib_spe);
 	server_json_stations_attrib(PSTR("stn_grp"), os.attrib_grp);
 
+	sid_t sid;
+	// nominal flow rates (x100) and whether each was entered by hand
+	bfill.emit_p(PSTR("\"stn_flow\":["));
+	for(sid=0;sid<os.nstations;sid++) {
+		bfill.emit_p(PSTR("$D"), os.get_station_flow(sid));
+		if(sid!=os.nstations-1)
+			bfill.emit_p(PSTR(","));
+	}
+	bfill.emit_p(PSTR("],\"stn_flwf\":["));
+	for(sid=0;sid<os.nstations;sid++) {
+		bfill.emit_p(PSTR("$D"), (os.attrib_flow[sid]&STATION_FLOW_FIXED)?1:0);
+		if(sid!=os.nstations-1)
+			bfill.emit_p(PSTR(","));
+	}
+	bfill.emit_p(PSTR("],"));
+	if (available_ether_buffer() <=0 ) {
+		send_packet(OTF_PARAMS);
+	}
+
 	bfill.emit_p(PSTR("\"snames\":["));
-	unsigned char sid;
 	for(sid=0;sid<os.nstations;sid++) {
 		os.get_station_name(sid, tmp_buffer);
 		bfill.emit_p(PSTR("\"$S\""), tmp_buffer);
@@ -485,7 +503,7 @@ void server_json_station_special(OTF_PARAMS_DEF) {
 	print_header();
 #endif
 
-	unsigned char sid;
+	sid_t sid;
 	unsigned char comma=0;
 	StationData *data = (StationData*)tmp_buffer;
 
@@ -516,7 +534,7 @@ void server_change_board_attrib(char *p, char header, unsigned char *attrib)
 	unsigned char bid;
 	tbuf2[0]=header;
 	for(bid=0;bid<os.nboards;bid++) {
-		snprintf(tbuf2+1, 3, "%d", bid);
+		snprintf(tbuf2+1, 4, "%d", bid);
 		if(findKeyVal(FKV_SOURCE, tmp_buffer, TMP_BUFFER_SIZE, tbuf2)) {
 			attrib[bid] = atoi(tmp_buffer);
 		}
@@ -530,12 +548,13 @@ void server_change_stations_attrib(char *p, char header, unsigned char *attrib)
 #endif
 {
 	char tbuf2[6] = {0, 0, 0, 0, 0, 0};
-	unsigned char bid, s, sid;
+	unsigned char bid, s;
+	sid_t sid;
 	tbuf2[0]=header;
 	for(bid=0;bid<os.nboards;bid++) {
 		for(s=0;s<8;s++) {
 			sid=bid*8+s;
-			snprintf(tbuf2+1, 3, "%d", sid);
+			snprintf(tbuf2+1, 5, "%d", sid);
 			if (findKeyVal(FKV_SOURCE, tmp_buffer, TMP_BUFFER_SIZE, tbuf2)) {
 				attrib[sid] = atoi(tmp_buffer);
 			}
@@ -555,6 +574,7 @@ void server_change_stations_attrib(char *p, char header, unsigned char *attrib)
  * q?: station sequential bit field
  * p?: station special flag bit field
  * g?: sequential group id
+ * f?: nominal flow rate x100 (0: learn from flow sensor)
  */
 void server_change_stations(OTF_PARAMS_DEF) {
 #if defined(USE_OTF)
@@ -563,11 +583,11 @@ void server_change_stations(OTF_PARAMS_DEF) {
 	char* p = get_buffer;
 #endif
 
-	unsigned char sid;
-	char tbuf2[5] = {'s', 0, 0, 0, 0};
+	sid_t sid;
+	char tbuf2[6] = {'s', 0, 0, 0, 0, 0};
 	// process station names
 	for(sid=0;sid<os.nstations;sid++) {
-		snprintf(tbuf2+1, 3, "%d", sid);
+		snprintf(tbuf2+1, 5, "%d", sid);
 		if(findKeyVal(FKV_SOURCE, tmp_buffer, TMP_BUFFER_SIZE, tbuf2)) {
 			#if !defined(USE_OTF)
 			urlDecode(tmp_buffer);
@@ -584,6 +604,16 @@ void server_change_stations(OTF_PARAMS_DEF) {
 	server_change_board_attrib(FKV_SOURCE, 'n', os.attrib_mas2); // master2
 	server_change_board_attrib(FKV_SOURCE, 'd', os.attrib_dis); // disable
 	server_change_stations_attrib(FKV_SOURCE, 'g', os.attrib_grp); // sequential groups
+	// nominal flow rates: a non-zero rate is fixed, 0 goes back to learning it
+	char tbuf3[6] = {'f', 0, 0, 0, 0, 0};
+	for(sid=0;sid<os.nstations;sid++) {
+		snprintf(tbuf3+1, 5, "%d", sid);
+		if(findKeyVal(FKV_SOURCE, tmp_buffer, TMP_BUFFER_SIZE, tbuf3)) {
+			long flow = atol(tmp_buffer);
+			if(flow<0 || flow>=STATION_FLOW_FIXED) handle_return(HTML_DATA_OUTOFBOUND);
+			os.attrib_flow[sid] = flow ? (flow | STATION_FLOW_FIXED) : 0;
+		}
+	}
 	/* handle special data */
 	if(findKeyVal(FKV_SOURCE, tmp_buffer, TMP_BUFFER_SIZE, PSTR("sid"), true)) {
 		sid = atoi(tmp_buffer);
@@ -615,7 +645,7 @@ void server_change_stations(OTF_PARAMS_DEF) {
 					handle_return(HTML_DATA_OUTOFBOUND);
 				}
 			}
-			// write spe data
+			// write spe data (attribs_save below drops the decoded copies kept in memory)
 			file_write_block(STATIONS_FILENAME, tmp_buffer,
 				(uint32_t)sid*sizeof(StationData)+offsetof(StationData,type), STATION_SPECIAL_DATA_SIZE+1);
 
@@ -649,7 +679,7 @@ uint16_t parse_listdata(char **p) {
 	return (uint16_t)atol(tmp_buffer);
 }
 
-void manual_start_program(unsigned char, unsigned char);
+void manual_start_program(pgid_t, unsigned char);
 /** Manual start program
  * Command: /mp?pw=xxx&pid=xxx&uwt=xxx
  *
@@ -723,7 +753,7 @@ void server_change_runonce(OTF_PARAMS_DEF) {
 	reset_all_stations_immediate();
 
 	ProgramStruct prog, annoprog;
-	unsigned char ns = os.nstations;
+	sid_t ns = os.nstations;
 
 	uint16_t dur;
 	for(int i=0;i<ns;i++) {
@@ -731,7 +761,7 @@ void server_change_runonce(OTF_PARAMS_DEF) {
 		prog.durations[i] = dur > 0 ? dur : 0;
 	}
 
-	unsigned char order[ns];
+	sid_t order[ns];
 	annoprog.name[0] = 0;
 	// check if anno parameter is provided
 	if(findKeyVal(FKV_SOURCE,tmp_buffer,PROGRAM_NAME_SIZE-1,PSTR("anno"),true)){
@@ -789,9 +819,10 @@ void server_change_runonce(OTF_PARAMS_DEF) {
 	}
 
 	//No repeat count defined or first repeat --> use old API
-	unsigned char sid, bid, s;
+	sid_t sid;
+	unsigned char bid, s;
 	boolean match_found = false;
-	for(unsigned char oi=0;oi<ns;oi++) {
+	for(sid_t oi=0;oi<ns;oi++) {
 		sid=order[oi];
 		dur=prog.durations[sid];
 		if(findKeyVal(FKV_SOURCE,tmp_buffer,TMP_BUFFER_SIZE,PSTR("uwt"),true)){
@@ -808,7 +839,7 @@ void server_change_runonce(OTF_PARAMS_DEF) {
 			if (q) {
 				q->st = 0;
 				q->dur = water_time_resolve(dur);
-				q->pid = 254;
+				q->pid = PROGRAM_ID_RUNONCE;
 				q->sid = sid;
 				match_found = true;
 			}
@@ -899,7 +930,7 @@ void server_change_program(OTF_PARAMS_DEF) {
 	char *p = get_buffer;
 #endif
 
-	unsigned char i;
+	sid_t i;
 
 	ProgramStruct prog;
 
@@ -1118,12 +1149,26 @@ void server_json_options(OTF_PARAMS_DEF) {
 }
 
 void server_json_programs_main(OTF_PARAMS_DEF) {
+#if !defined(USE_OTF)
+	char *p = get_buffer;
+#endif
+	// optional page: programs start .. start+num-1 (default: all programs)
+	pgid_t start = 0, end = pd.nprograms;
+	if (findKeyVal(FKV_SOURCE, tmp_buffer, TMP_BUFFER_SIZE, PSTR("start"), true)) {
+		long v = atol(tmp_buffer);
+		start = (v<0) ? 0 : (v>end) ? end : v;
+	}
+	if (findKeyVal(FKV_SOURCE, tmp_buffer, TMP_BUFFER_SIZE, PSTR("num"), true)) {
+		long v = atol(tmp_buffer);
+		if (v>=0 && v<end-start) end = start+v;
+	}
 
-	bfill.emit_p(PSTR("\"nprogs\":$D,\"nboards\":$D,\"mnp\":$D,\"mnst\":$D,\"pnsize\":$D,\"pd\":["),
-							 pd.nprograms, os.nboards, MAX_NUM_PROGRAMS, MAX_NUM_STARTTIMES, PROGRAM_NAME_SIZE);
-	unsigned char pid, i;
+	bfill.emit_p(PSTR("\"nprogs\":$D,\"start\":$D,\"nboards\":$D,\"mnp\":$D,\"mnst\":$D,\"pnsize\":$D,\"pd\":["),
+							 pd.nprograms, start, os.nboards, MAX_NUM_PROGRAMS, MAX_NUM_STARTTIMES, PROGRAM_NAME_SIZE);
+	pgid_t pid;
+	sid_t i;
 	ProgramStruct prog;
-	for(pid=0;pid<pd.nprograms;pid++) {
+	for(pid=start;pid<end;pid++) {
 		pd.read(pid, &prog);
 		if (prog.type == PROGRAM_TYPE_INTERVAL && prog.days[1] >= 1) {
 			pd.drem_to_relative(prog.days);
@@ -1139,13 +1184,16 @@ void server_json_programs_main(OTF_PARAMS_DEF) {
 		// station water time
 		for (i=0; i<os.nstations-1; i++) {
 			bfill.emit_p(PSTR("$L,"),(unsigned long)prog.durations[i]);
+			if (available_ether_buffer() <= 0) {
+				send_packet(OTF_PARAMS);
+			}
 		}
 		bfill.emit_p(PSTR("$L],\""),(unsigned long)prog.durations[i]); // this is the last element
 		// program name
 		strncpy(tmp_buffer, prog.name, PROGRAM_NAME_SIZE);
 		tmp_buffer[PROGRAM_NAME_SIZE] = 0;	// make sure the string ends
 		bfill.emit_p(PSTR("$S\",[$D,$D,$D]]"), tmp_buffer,prog.en_daterange,prog.daterange[0],prog.daterange[1]);
-		if(pid!=pd.nprograms-1) {
+		if(pid!=end-1) {
 			bfill.emit_p(PSTR(","));
 		}
 		// push out a packet if available
@@ -1157,7 +1205,14 @@ void server_json_programs_main(OTF_PARAMS_DEF) {
 	bfill.emit_p(PSTR("]}"));
 }
 
-/** Output program data */
+/**
+ * Output program data
+ * Command: /jp?pw=xxx&start=x&num=x
+ *
+ * start: index of the first program to output (optional, default 0)
+ * num:   number of programs to output (optional, default all)
+ * nprogs in the response is always the total number of programs
+ */
 void server_json_programs(OTF_PARAMS_DEF) {
 #if defined(USE_OTF)
 	if(!process_password(OTF_PARAMS)) return;
@@ -1195,7 +1250,8 @@ function rst_wsp() {document.getElementById('wsp').value='$S';}</script>)"),
 }
 
 void server_json_controller_main(OTF_PARAMS_DEF) {
-	unsigned char bid, sid;
+	unsigned char bid;
+	sid_t sid;
 	time_os_t curr_time = os.now_tz();
 	bfill.emit_p(PSTR("\"devt\":$L,\"nbrd\":$D,\"en\":$D,\"sn1\":$D,\"sn2\":$D,\"rd\":$D,\"rdst\":$L,"
 										"\"sunrise\":$D,\"sunset\":$D,\"eip\":$L,\"lwc\":$L,\"lswc\":$L,"
@@ -1215,7 +1271,7 @@ void server_json_controller_main(OTF_PARAMS_DEF) {
 							os.powerup_lasttime,
 							os.last_reboot_cause,
 							pd.lastrun.station,
-							pd.lastrun.program,
+							wire_pid(pd.lastrun.program),
 							pd.lastrun.duration,
 							pd.lastrun.endtime,
 							os.status.pause_state,
@@ -1287,14 +1343,14 @@ void server_json_controller_main(OTF_PARAMS_DEF) {
 			send_packet(OTF_PARAMS);
 		}
 		unsigned long rem = 0;
-		unsigned char qid = pd.station_qid[sid];
+		qid_t qid = pd.station_qid[sid];
 		RuntimeQueueStruct *q = pd.queue + qid;
-		if (qid<255) {
+		if (qid!=QID_NONE) {
 			rem = (curr_time >= q->st) ? (q->st+q->dur-curr_time) : q->dur;
 			if(rem>65535) rem = 0;
 		}
 		bfill.emit_p(PSTR("[$D,$L,$L,$D]"),
-		(qid<255)?q->pid:0, rem, (qid<255)?q->st:0, os.attrib_grp[sid]);
+		(qid!=QID_NONE)?wire_pid(q->pid):0, rem, (qid!=QID_NONE)?q->st:0, os.attrib_grp[sid]);
 		bfill.emit_p((sid<os.nstations-1)?PSTR(","):PSTR("]"));
 	}
 
@@ -1713,7 +1769,7 @@ void server_change_password(OTF_PARAMS_DEF) {
 
 void server_json_status_main() {
 	bfill.emit_p(PSTR("\"sn\":["));
-	unsigned char sid;
+	sid_t sid;
 
 	for (sid=0;sid<os.nstations;sid++) {
 		bfill.emit_p(PSTR("$D"), (os.station_bits[(sid>>3)]>>(sid&0x07))&1);
@@ -1738,15 +1794,65 @@ void server_json_status(OTF_PARAMS_DEF)
 	handle_return(HTML_OK);
 }
 
+/** Turn a station on (for timer seconds) or off, as /cm does
+ * schedule=false leaves schedule_all_stations to the caller
+ */
+static unsigned char manual_switch(sid_t sid, unsigned char en, uint16_t timer, uint16_t timer_ms, unsigned char ssta, time_os_t curr_time, bool schedule) {
+	if (en) {
+		// schedule manual station
+		// skip if the station is a master station
+		// (because master cannot be scheduled independently)
+		if ((os.status.mas==sid+1) || (os.status.mas2==sid+1))
+			return HTML_NOT_PERMITTED;
+
+		RuntimeQueueStruct *q = NULL;
+		qid_t sqi = pd.station_qid[sid];
+		// check if the station already has a schedule
+		if (sqi!=QID_NONE) { // if so, do nothing
+
+		} else {  // otherwise create a new queue element
+			q = pd.enqueue();
+		}
+		// if the queue is not full (and the station doesn't already have a schedule
+		if (q) {
+			q->st = 0;
+			q->dur = timer;
+#if !defined(ARDUINO)
+			q->dur_ms = timer_ms;
+#endif
+			q->sid = sid;
+			q->pid = PROGRAM_ID_MANUAL;  // testing stations are assigned program index PROGRAM_ID_MANUAL
+			if (schedule) schedule_all_stations(curr_time);
+		} else {
+			return HTML_NOT_PERMITTED;
+		}
+	} else {	// turn off station
+		// mark station for removal
+		if(pd.station_qid[sid]==QID_NONE) {
+			// return error message if turning off a zone that's not currently in the queue
+			return HTML_DATA_OUTOFBOUND;
+		} else {
+			RuntimeQueueStruct *q = pd.queue + pd.station_qid[sid];
+			q->deque_time = curr_time;
+			turn_off_station(sid, curr_time, ssta);
+		}
+	}
+	return HTML_SUCCESS;
+}
+
 /**
  * Test station (previously manual operation)
  * Command: /cm?pw=xxx&sid=x&en=x&t=x&ssta=x
+ *      or: /cm?pw=xxx&m=sid:en:t,sid:en:t,...
  *
  * pw: password
  * sid:station index (starting from 0)
  * en: enable (0 or 1)
- * t:  timer (required if en=1)
+ * t:  timer (required if en=1), in seconds. Linux builds take up to 3 decimals (e.g. 0.25)
  * ssta: shift remaining stations
+ * m:  switch several stations in one request (used by controllers batching their
+ *     remote station switches). Stations that can't be switched are skipped; if none
+ *     could be, the error of the last one is returned.
  */
 void server_change_manual(OTF_PARAMS_DEF) {
 #if defined(USE_OTF)
@@ -1755,6 +1861,39 @@ void server_change_manual(OTF_PARAMS_DEF) {
 	char *p = get_buffer;
 #endif
 
+	unsigned long curr_time = os.now_tz();
+	if (findKeyVal(FKV_SOURCE, tmp_buffer, TMP_BUFFER_SIZE, PSTR("m"), true)) {
+		// switching a station off may reuse tmp_buffer, so rather than copying the list
+		// it is looked up again for the next item
+		unsigned char ret = HTML_DATA_FORMATERROR; // result of the last item that failed
+		bool applied = false, scheduled = false;
+		int pos = 0;
+		while (pos>=0 && tmp_buffer[pos]) {
+			char *e;
+			long sid = strtol(tmp_buffer+pos, &e, 10);
+			unsigned char en = 0;
+			long timer = 0;
+			if (*e==':') en = (unsigned char)strtol(e+1, &e, 10);
+			if (*e==':') timer = strtol(e+1, &e, 10);
+			char *next = strchr(e, ',');
+			pos = next ? next+1-tmp_buffer : -1;
+			unsigned char r = HTML_DATA_OUTOFBOUND;
+			if (sid>=0 && sid<os.nstations && (!en || (timer>0 && timer<=64800))) {
+				r = manual_switch(sid, en, timer, 0, 0, curr_time, false);
+			}
+			if (r==HTML_SUCCESS) {
+				applied = true;
+				if (en) scheduled = true;
+			} else {
+				ret = r;
+			}
+			if (pos>=0) findKeyVal(FKV_SOURCE, tmp_buffer, TMP_BUFFER_SIZE, PSTR("m"), true);
+		}
+		if (scheduled) schedule_all_stations(curr_time);
+		if (applied) ret = HTML_SUCCESS;
+		handle_return(ret);
+	}
+
 	int sid=-1;
 	if (findKeyVal(FKV_SOURCE, tmp_buffer, TMP_BUFFER_SIZE, PSTR("sid"), true)) {
 		sid=atoi(tmp_buffer);
@@ -1771,56 +1910,28 @@ void server_change_manual(OTF_PARAMS_DEF) {
 	}
 
 	uint16_t timer=0;
-	unsigned long curr_time = os.now_tz();
+	uint16_t timer_ms=0;
+	unsigned char ssta = 0;
 	if (en) { // if turning on a station, must provide timer
 		if (findKeyVal(FKV_SOURCE, tmp_buffer, TMP_BUFFER_SIZE, PSTR("t"), true)) {
 			timer=(uint16_t)atol(tmp_buffer);
+#if !defined(ARDUINO)
+			timer_ms = parse_ms_fraction(tmp_buffer); // sub-second runs, e.g. t=0.5
+			if (timer_ms) timer++; // the run ends within its last second
+#endif
 			if (timer==0 || timer>64800) {
 				handle_return(HTML_DATA_OUTOFBOUND);
 			}
-			// schedule manual station
-			// skip if the station is a master station
-			// (because master cannot be scheduled independently)
-			if ((os.status.mas==sid+1) || (os.status.mas2==sid+1))
-				handle_return(HTML_NOT_PERMITTED);
-
-			RuntimeQueueStruct *q = NULL;
-			unsigned char sqi = pd.station_qid[sid];
-			// check if the station already has a schedule
-			if (sqi!=0xFF) { // if so, do nothing
-
-			} else {  // otherwise create a new queue element
-				q = pd.enqueue();
-			}
-			// if the queue is not full (and the station doesn't already have a schedule
-			if (q) {
-				q->st = 0;
-				q->dur = timer;
-				q->sid = sid;
-				q->pid = 99;  // testing stations are assigned program index 99
-				schedule_all_stations(curr_time);
-			} else {
-				handle_return(HTML_NOT_PERMITTED);
-			}
 		} else {
 			handle_return(HTML_DATA_MISSING);
 		}
-	} else {	// turn off station
-		unsigned char ssta = 0;
+	} else {
 		if (findKeyVal(FKV_SOURCE, tmp_buffer, TMP_BUFFER_SIZE, PSTR("ssta"), true)) {
 			ssta = atoi(tmp_buffer);
 		}
-		// mark station for removal
-		if(pd.station_qid[sid]==255) {
-			// return error message if turning off a zone that's not currently in the queue
-			handle_return(HTML_DATA_OUTOFBOUND);
-		} else {
-			RuntimeQueueStruct *q = pd.queue + pd.station_qid[sid];
-			q->deque_time = curr_time;
-			turn_off_station(sid, curr_time, ssta);
-		}
 	}
-	handle_return(HTML_SUCCESS);
+	unsigned char ret = manual_switch(sid, en, timer, timer_ms, ssta, curr_time, true);
+	handle_return(ret);
 }
 
 
@@ -1851,6 +1962,21 @@ int file_fgets(File file, char* buf, int maxsize) {
  *        rs, rd, wl
  *        if unspecified, output all records
  */
+#if !defined(ARDUINO)
+/** Station records logged with the wide ids of manual, run-once and test runs
+ * are reported with their 8-bit ids, like the log writer does now */
+static void log_wire_pid(char *line) {
+	if (line[0] != '[') return;
+	char *end;
+	ulong pid = strtoul(line+1, &end, 10);
+	if (*end != ',' || pid < PROGRAM_ID_MANUAL || pid > PROGRAM_ID_TEST) return;
+	char num[4];
+	int n = snprintf(num, sizeof(num), "%u", wire_pid((pgid_t)pid));
+	memmove(line+1+n, end, strlen(end)+1);
+	memcpy(line+1, num, n);
+}
+#endif
+
 void server_json_log(OTF_PARAMS_DEF) {
 
 #if defined(USE_OTF)
@@ -1959,6 +2085,9 @@ void server_json_log(OTF_PARAMS_DEF) {
 			// if type is not specified, output everything except "wl" and "fl" records
 			if (!type_specified && (!strncmp("wl", ptype+1, 2) || !strncmp("fl", ptype+1, 2)))
 				continue;
+		#if !defined(ARDUINO)
+			log_wire_pid(tmp_buffer);
+		#endif
 			// if this is the first record, do not print comma
 			if (comma)	bfill.emit_p(PSTR(","));
 			else {comma=1;}
@@ -32,12 +32,37 @@
 #endif
 
 // Declare static data members
-unsigned char ProgramData::nprograms = 0;
-unsigned char ProgramData::nqueue = 0;
+pgid_t ProgramData::nprograms = 0;
+#if !defined(ARDUINO)
+ProgramSched *ProgramData::sched = NULL;
+pgid_t ProgramData::sched_size = 0;
+#endif
+qid_t ProgramData::nqueue = 0;
+#if defined(LARGE_INSTALL)
+RuntimeQueueStruct *ProgramData::queue = NULL;
+qid_t ProgramData::queue_size = 0;
+qid_t *ProgramData::station_qid = NULL;
+sid_t ProgramData::table_size = 0;
+sid_t *ProgramData::event_sids = NULL;
+sid_t *ProgramData::event_pos = NULL;
+time_os_t *ProgramData::event_times = NULL;
+#else
 RuntimeQueueStruct ProgramData::queue[RUNTIME_QUEUE_SIZE];
-unsigned char ProgramData::station_qid[MAX_NUM_STATIONS];
+qid_t ProgramData::station_qid[MAX_NUM_STATIONS];
+sid_t ProgramData::event_sids[MAX_NUM_STATIONS];
+sid_t ProgramData::event_pos[MAX_NUM_STATIONS];
+time_os_t ProgramData::event_times[MAX_NUM_STATIONS];
+#endif
+qid_t ProgramData::group_qid[MAX_SEQ_GROUPS];
+sid_t ProgramData::nevents = 0;
+uint32_t ProgramData::seq_dirty = 0;
+MasterWindows ProgramData::mas_windows[NUM_MASTER_ZONES];
+unsigned char ProgramData::mas_dirty = (1<<NUM_MASTER_ZONES)-1;
+#if !defined(ARDUINO)
+bool ProgramData::queue_changed = false;
+#endif
 LogStruct ProgramData::lastrun;
-time_os_t ProgramData::last_seq_stop_times[NUM_SEQ_GROUPS];
+time_os_t ProgramData::last_seq_stop_times[MAX_SEQ_GROUPS];
 
 extern char tmp_buffer[];
 
@@ -47,50 +72,632 @@ void ProgramData::init() {
 }
 
 void ProgramData::reset_runtime() {
-	memset(station_qid, 0xFF, MAX_NUM_STATIONS);  // reset station qid to 0xFF
+#if defined(LARGE_INSTALL)
+	resize_tables(os.nstations);
+	memset(station_qid, 0xFF, table_size*sizeof(qid_t));  // reset station qid to QID_NONE
+	memset(event_pos, 0xFF, table_size*sizeof(sid_t));
+#else
+	memset(station_qid, 0xFF, sizeof(station_qid));  // reset station qid to QID_NONE
+	memset(event_pos, 0xFF, sizeof(event_pos));
+#endif
+	memset(group_qid, 0xFF, sizeof(group_qid));
+	nevents = 0;
+	seq_dirty = 0;
+	invalidate_master_windows();
+#if !defined(ARDUINO)
+	queue_changed = true;
+#endif
 	nqueue = 0;
 	memset(last_seq_stop_times, 0, sizeof(last_seq_stop_times));
 }
 
+#if defined(LARGE_INSTALL)
+/** Grow the per-station tables to hold n stations
+ * Existing entries are kept, so this is safe while stations are queued.
+ * Returns the number of stations the tables hold, less than n if memory ran out
+ */
+sid_t ProgramData::resize_tables(sid_t n) {
+	if (n > table_size) {
+		qid_t *sq = (qid_t*)realloc(station_qid, n*sizeof(qid_t));
+		if (sq) station_qid = sq;
+		sid_t *es = (sid_t*)realloc(event_sids, n*sizeof(sid_t));
+		if (es) event_sids = es;
+		sid_t *ep = (sid_t*)realloc(event_pos, n*sizeof(sid_t));
+		if (ep) event_pos = ep;
+		time_os_t *et = (time_os_t*)realloc(event_times, n*sizeof(time_os_t));
+		if (et) event_times = et;
+		if (!sq || !es || !ep || !et) {
+			DEBUG_PRINTLN(F("out of memory for station tables"));
+			return table_size; // the tables that did grow still work at the old size
+		}
+		memset(station_qid+table_size, 0xFF, (n-table_size)*sizeof(qid_t));
+		memset(event_pos+table_size, 0xFF, (n-table_size)*sizeof(sid_t));
+		table_size = n;
+	}
+	if (queue_size < n) grow_queue();
+	return table_size;
+}
+
+/** Grow the queue to hold at least one element per station, or double it if it's full */
+bool ProgramData::grow_queue() {
+	ulong n = (queue_size < os.nstations) ? os.nstations : (ulong)queue_size*2;
+	if (n > QID_NONE) n = QID_NONE; // QID_NONE itself is never a valid index
+	if (n <= queue_size) return false;
+	RuntimeQueueStruct *p = (RuntimeQueueStruct*)realloc(queue, n*sizeof(RuntimeQueueStruct));
+	if (!p) return false;
+	queue = p;
+	queue_size = n;
+	return true;
+}
+#endif
+
 /** Insert a new element to the queue
  * This function returns pointer to the next available element in the queue
  * and returns NULL if the queue is full
+ * The element is not linked to its station until it's scheduled
+ * In large-install builds the queue grows instead, which moves it:
+ * pointers to queue elements don't stay valid across this call
  */
 RuntimeQueueStruct* ProgramData::enqueue() {
+#if defined(LARGE_INSTALL)
+	if (nqueue >= queue_size) grow_queue();
+#endif
 	if (nqueue < RUNTIME_QUEUE_SIZE) {
+		RuntimeQueueStruct *q = queue + nqueue;
 		nqueue ++;
-		return queue + (nqueue-1);
+		q->gid = PARALLEL_GROUP_ID;
+		q->snext = q->gprev = q->gnext = QID_NONE;
+#if !defined(ARDUINO)
+		q->dur_ms = 0;
+#endif
+		return q;
 	} else {
 		return NULL;
 	}
 }
 
+/** Queue a program run of a station
+ * If the station already has a pending run (one that hasn't started),
+ * or a running parallel run (no other run is scheduled from its end),
+ * the new run is merged into it according to the queue merge option.
+ * A scheduled run's duration is changed in place, and the runs after it
+ * in its sequential group are moved by the same amount.
+ * Returns the new or merged element, or NULL if the queue is full
+ */
+RuntimeQueueStruct* ProgramData::enqueue(sid_t sid, ulong dur, pgid_t pid, time_os_t curr_time) {
+	unsigned char policy = os.iopts[IOPT_QUEUE_MERGE];
+	RuntimeQueueStruct *q, *m = NULL;
+	if (policy != QUEUE_MERGE_APPEND) {
+		for (q = queue; q < queue+nqueue; q++) {
+			if (q->sid!=sid || !q->dur) continue;
+			if (!q->st || q->st>curr_time) m = q;
+			else if (!m && q->gid==PARALLEL_GROUP_ID && q->st+q->dur>curr_time) m = q;
+		}
+	}
+	if (dur > 0xFFFF) dur = 0xFFFF;
+	if (m) {
+		// durations are counted from the run's start, so for a running run
+		// the time it has already run is kept and only the remainder changes
+		ulong elapsed = (m->st && m->st<=curr_time) ? curr_time-m->st : 0;
+		ulong d = m->dur;
+		if (policy == QUEUE_MERGE_EXTEND) {
+			d += dur;
+		} else if (policy == QUEUE_MERGE_REPLACE || dur > m->dur-elapsed) {
+			d = elapsed + dur;
+			m->pid = pid;
+		}
+		if (d > 0xFFFF) d = 0xFFFF;
+		if (d != m->dur) {
+#if !defined(ARDUINO)
+			m->dur_ms = 0; // the merged run ends on a whole second
+#endif
+			long delta = (long)d - (long)m->dur;
+			m->dur = d;
+			if (m->st) {
+				m->deque_time += delta;
+				touch_station(sid);
+				if (!elapsed && m->gid!=PARALLEL_GROUP_ID) {
+					// move the runs after it in its sequential group by as much, keeping their order and spacing
+					for (qid_t i=group_qid[m->gid]; i!=QID_NONE; i=queue[i].gnext) {
+						RuntimeQueueStruct *g = queue+i;
+						if (g->st<=m->st) continue;
+						g->st += delta;
+						g->deque_time += delta;
+						touch_station(g->sid);
+					}
+					update_seq_stop_times(); // runs queued next are placed after the new end of the group
+				}
+			}
+		}
+		return m;
+	}
+	q = enqueue();
+	if (q) {
+		q->st = 0;
+		q->dur = dur;
+		q->sid = sid;
+		q->pid = pid;
+	}
+	return q;
+}
+
 /** Remove an element from the queue
  * This function copies the last element of
  * the queue to overwrite the requested
  * element, therefore removing the requested element.
  */
 // this removes an element from the queue
-void ProgramData::dequeue(unsigned char qid) {
+void ProgramData::dequeue(qid_t qid) {
 	if (qid>=nqueue)	return;
+	sid_t sid = queue[qid].sid;
+	unlink(qid);
 	if (qid<nqueue-1) {
-		queue[qid] = queue[nqueue-1]; // copy the last element to the dequeud element to fill the space
-		if(station_qid[queue[qid].sid] == nqueue-1) // fix queue index if necessary
-			station_qid[queue[qid].sid] = qid;
+		qid_t last = nqueue-1;
+		RuntimeQueueStruct *q = queue+qid;
+		*q = queue[last]; // copy the last element to the dequeud element to fill the space
+		// fix links that refer to the moved element
+		qid_t *p = &station_qid[q->sid];
+		while (*p!=QID_NONE && *p!=last) p = &queue[*p].snext;
+		if (*p==last) *p = qid;
+		if (q->gid!=PARALLEL_GROUP_ID) {
+			if (q->gprev!=QID_NONE) queue[q->gprev].gnext = qid;
+			else group_qid[q->gid] = qid;
+			if (q->gnext!=QID_NONE) queue[q->gnext].gprev = qid;
+		}
 	}
 	nqueue--;
+	touch_station(sid);
+}
+
+/** Link a scheduled element
+ * Inserts the element into its station's list (ordered by start time)
+ * and, for sequential stations, into its group's list
+ */
+void ProgramData::link(qid_t qid) {
+	RuntimeQueueStruct *q = queue+qid;
+	unlink(qid);
+	qid_t *p = &station_qid[q->sid];
+	while (*p!=QID_NONE && queue[*p].st<=q->st) p = &queue[*p].snext;
+	q->snext = *p;
+	*p = qid;
+	if (os.is_sequential_station(q->sid) && !os.iopts[IOPT_REMOTE_EXT_MODE]) {
+		unsigned char gid = os.get_station_gid(q->sid);
+		q->gid = gid;
+		q->gprev = QID_NONE;
+		q->gnext = group_qid[gid];
+		if (q->gnext!=QID_NONE) queue[q->gnext].gprev = qid;
+		group_qid[gid] = qid;
+		seq_dirty |= (1UL<<gid);
+	}
+	touch_station(q->sid);
+}
+
+/** Unlink an element from its station and group (no-op if not linked) */
+void ProgramData::unlink(qid_t qid) {
+	RuntimeQueueStruct *q = queue+qid;
+	qid_t *p = &station_qid[q->sid];
+	while (*p!=QID_NONE && *p!=qid) p = &queue[*p].snext;
+	if (*p!=qid) return;
+	*p = q->snext;
+	if (q->gid!=PARALLEL_GROUP_ID) {
+		if (q->gprev!=QID_NONE) queue[q->gprev].gnext = q->gnext;
+		else group_qid[q->gid] = q->gnext;
+		if (q->gnext!=QID_NONE) queue[q->gnext].gprev = q->gprev;
+		seq_dirty |= (1UL<<q->gid);
+	}
+	q->gid = PARALLEL_GROUP_ID;
+	q->snext = q->gprev = q->gnext = QID_NONE;
+}
+
+/** Re-evaluate a station at the next tick
+ * Must be called whenever the start, duration or dequeue time
+ * of any of the station's queue elements changes
+ */
+void ProgramData::touch_station(sid_t sid) {
+	// re-sort the station's list by start time (lists are short)
+	qid_t head = QID_NONE, qid = station_qid[sid], next;
+	qid_t *p;
+	while (qid!=QID_NONE) {
+		next = queue[qid].snext;
+		p = &head;
+		while (*p!=QID_NONE && queue[*p].st<=queue[qid].st) p = &queue[*p].snext;
+		queue[qid].snext = *p;
+		*p = qid;
+		if (queue[qid].gid!=PARALLEL_GROUP_ID) seq_dirty |= (1UL<<queue[qid].gid);
+		qid = next;
+	}
+	station_qid[sid] = head;
+	mas_dirty = (1<<NUM_MASTER_ZONES)-1;
+#if !defined(ARDUINO)
+	queue_changed = true;
+#endif
+	if (head==QID_NONE) heap_remove(sid);
+	else set_event_time(sid, 0);
+}
+
+/** Return the station with the earliest event if it's due, or SID_NONE */
+sid_t ProgramData::next_due_station(time_os_t curr_time) {
+	if (nevents && event_times[event_sids[0]]<=curr_time) return event_sids[0];
+	return SID_NONE;
+}
+
+/** Dequeue a station's expired elements and compute its next event time
+ * The next event is the earliest future time at which the per-second
+ * time keeping would act on the station: start, stop or dequeue
+ */
+void ProgramData::update_station(sid_t sid, time_os_t curr_time) {
+	qid_t qid = station_qid[sid];
+	while (qid!=QID_NONE) {
+		RuntimeQueueStruct *q = queue+qid;
+		if (!q->dur || curr_time>=q->deque_time) {
+			dequeue(qid);
+			qid = station_qid[sid]; // indices may have moved, start over
+		} else {
+			qid = q->snext;
+		}
+	}
+	qid = station_qid[sid];
+	if (qid==QID_NONE) {
+		heap_remove(sid);
+		return;
+	}
+	RuntimeQueueStruct *q = queue+qid;
+	time_os_t t = q->deque_time;
+	if (q->st && os.status.mas!=sid+1 && os.status.mas2!=sid+1) {
+		unsigned char running = os.is_running(sid);
+		if (curr_time<q->st) t = q->st;
+		else if (curr_time<q->st+q->dur) t = running ? q->st+q->dur : curr_time+1;
+		else if (running) t = curr_time+1;
+#if !defined(ARDUINO)
+		// a run that ends within its last second is due at the start of that second,
+		// when its millisecond edge is armed
+		if (running && q->dur_ms && t==q->st+q->dur && curr_time+1<t) t--;
+#endif
+	}
+	for (; qid!=QID_NONE; qid=queue[qid].snext) {
+		if (queue[qid].deque_time<t) t = queue[qid].deque_time;
+	}
+	set_event_time(sid, t);
+}
+
+/** Recalculate the last stop time of sequential groups that have changed */
+void ProgramData::update_seq_stop_times() {
+	for (unsigned char gid=0; seq_dirty && gid<MAX_SEQ_GROUPS; gid++) {
+		if (!(seq_dirty&(1UL<<gid))) continue;
+		time_os_t sst = 0;
+		for (qid_t qid=group_qid[gid]; qid!=QID_NONE; qid=queue[qid].gnext) {
+			if (queue[qid].st+queue[qid].dur>sst) sst = queue[qid].st+queue[qid].dur;
+		}
+		last_seq_stop_times[gid] = sst;
+		seq_dirty &= ~(1UL<<gid);
+	}
+}
+
+/** Copy the stations that have queue elements into sids
+ * The list is a snapshot, so it stays valid while stations are turned off
+ */
+sid_t ProgramData::get_active_stations(sid_t *sids) {
+	memcpy(sids, event_sids, nevents*sizeof(sid_t));
+	return nevents;
+}
+
+/** Whether master mas should be on at curr_time
+ * The master's windows are rebuilt from the queue only when the queue
+ * or the master's options have changed; otherwise this is a lookup
+ */
+unsigned char ProgramData::master_on(unsigned char mas, time_os_t curr_time) {
+	MasterWindows *w = mas_windows+mas;
+	if ((mas_dirty&(1<<mas)) || w->sid!=os.get_master_id(mas) ||
+		w->on_adj!=os.get_on_adj(mas) || w->off_adj!=os.get_off_adj(mas) ||
+		curr_time<w->built || (w->horizon && curr_time>=w->horizon)) {
+		build_master_windows(mas, curr_time);
+	}
+	while (w->cur<w->n && w->off[w->cur]<curr_time) w->cur++;
+	return (w->cur<w->n && w->on[w->cur]<=curr_time);
+}
+
+/** Rebuild the on-windows of master mas from the queue
+ * Windows that ended before curr_time are left out
+ */
+void ProgramData::build_master_windows(unsigned char mas, time_os_t curr_time) {
+	MasterWindows *w = mas_windows+mas;
+	w->sid = os.get_master_id(mas);
+	w->on_adj = os.get_on_adj(mas);
+	w->off_adj = os.get_off_adj(mas);
+	w->n = w->cur = 0;
+	w->built = curr_time;
+	w->horizon = 0;
+	mas_dirty &= ~(1<<mas);
+	if (!w->sid) return;
+	for (sid_t i=0; i<nevents; i++) {
+		sid_t sid = event_sids[i];
+		// skip the master station itself and stations not bound to it
+		if (w->sid==sid+1 || !os.bound_to_master(sid, mas)) continue;
+		for (qid_t qid=station_qid[sid]; qid!=QID_NONE; qid=queue[qid].snext) {
+			RuntimeQueueStruct *q = queue+qid;
+			if (!q->st) continue; // not scheduled yet
+			time_os_t off = q->st+q->dur+w->off_adj;
+			if (off<curr_time) continue;
+			add_master_window(w, q->st+w->on_adj, off);
+		}
+	}
+}
+
+/** Merge [on, off] into a master's window list
+ * If the list is full, the latest window is dropped and the list
+ * is then only complete up to its start (horizon)
+ */
+void ProgramData::add_master_window(MasterWindows *w, time_os_t on, time_os_t off) {
+	if (w->horizon && on>=w->horizon) return;
+	// binary search for the first window that doesn't end before on (windows are disjoint, so ends are sorted too)
+	unsigned char i = 0, j = w->n, k;
+	while (i<j) {
+		k = (i+j)/2;
+		if (w->off[k]+1<on) i = k+1;
+		else j = k;
+	}
+	// windows i..j-1 overlap or touch [on, off]
+	for (j=i; j<w->n && w->on[j]<=off+1; j++) {
+		if (w->on[j]<on) on = w->on[j];
+		if (w->off[j]>off) off = w->off[j];
+	}
+	if (j==i) {
+		if (w->n==MAX_MASTER_WINDOWS) {
+			if (i==w->n) { w->horizon = on; return; }
+			w->n--;
+			w->horizon = w->on[w->n];
+		}
+		memmove(w->on+i+1, w->on+i, (w->n-i)*sizeof(time_os_t));
+		memmove(w->off+i+1, w->off+i, (w->n-i)*sizeof(time_os_t));
+		w->n++;
+	} else if (j>i+1) {
+		memmove(w->on+i+1, w->on+j, (w->n-j)*sizeof(time_os_t));
+		memmove(w->off+i+1, w->off+j, (w->n-j)*sizeof(time_os_t));
+		w->n -= j-i-1;
+	}
+	w->on[i] = on;
+	w->off[i] = off;
+}
+
+#if !defined(ARDUINO)
+/** Write the queue snapshot, if the queue has changed since the last one
+ * The snapshot is written to a temporary file first and then renamed,
+ * so a restart in the middle of writing leaves the previous one intact
+ */
+void ProgramData::save_queue(time_os_t curr_time) {
+	if (!queue_changed) return;
+	queue_changed = false;
+	if (!nqueue) {
+		remove_file(QUEUE_FILENAME);
+		return;
+	}
+	char path[PATH_MAX];
+	strncpy(path, get_filename_fullpath(QUEUE_FILENAME), PATH_MAX-5);
+	path[PATH_MAX-5] = 0;
+	strcat(path, ".tmp");
+	FILE *fp = fopen(path, "wb");
+	if (!fp) return;
+
+	QueueFileHeader h;
+	memset(&h, 0, sizeof(h));
+	h.magic = QUEUE_FILE_MAGIC;
+	h.version = QUEUE_FILE_VERSION;
+	h.record_size = sizeof(QueueRecord);
+	h.nqueue = nqueue;
+	h.pause_end = os.status.pause_state ? curr_time+os.pause_timer : 0;
+	bool ok = (fwrite(&h, sizeof(h), 1, fp)==1);
+	QueueRecord r;
+	for (qid_t qid=0; ok && qid<nqueue; qid++) {
+		RuntimeQueueStruct *q = queue+qid;
+		memset(&r, 0, sizeof(r));
+		r.st = q->st;
+		r.deque_time = q->deque_time;
+		r.dur = q->dur;
+		r.dur_ms = q->dur_ms;
+		r.sid = q->sid;
+		r.pid = q->pid;
+		ok = (fwrite(&r, sizeof(r), 1, fp)==1);
+	}
+	if (fclose(fp)!=0) ok = false;
+	if (!ok || rename(path, get_filename_fullpath(QUEUE_FILENAME))!=0) {
+		remove(path);
+		queue_changed = true; // try again at the next tick
+	}
+}
+
+/** Reload the queue snapshot after a restart
+ * Runs that ended while the controller was down are dropped, and runs
+ * that were in progress continue with the time they have left
+ */
+void ProgramData::restore_queue(time_os_t curr_time) {
+	QueueFileHeader h;
+	memset(&h, 0, sizeof(h));
+	if (!file_exists(QUEUE_FILENAME)) return;
+	file_read_block(QUEUE_FILENAME, &h, 0, sizeof(h));
+	if (h.magic!=QUEUE_FILE_MAGIC || h.version!=QUEUE_FILE_VERSION || h.record_size!=sizeof(QueueRecord)) {
+		DEBUG_PRINTLN(F("incompatible queue snapshot"));
+		remove_file(QUEUE_FILENAME);
+		return;
+	}
+	QueueRecord r;
+	for (uint32_t i=0; i<h.nqueue; i++) {
+		memset(&r, 0, sizeof(r));
+		file_read_block(QUEUE_FILENAME, &r, sizeof(h)+i*sizeof(r), sizeof(r));
+		if (!r.st || !r.dur || r.sid>=os.nstations) continue;
+		if (r.st+r.dur<=curr_time) continue; // ended during the downtime
+		RuntimeQueueStruct *q = enqueue();
+		if (!q) break;
+		q->st = r.st;
+		q->dur = r.dur;
+		q->dur_ms = r.dur_ms;
+		q->sid = r.sid;
+		q->pid = r.pid;
+		q->deque_time = r.deque_time;
+		if (q->st<curr_time) { // was running: continue with what's left
+			q->dur -= curr_time-q->st;
+			q->st = curr_time;
+		}
+		link(q-queue);
+	}
+	if (h.pause_end>curr_time) {
+		os.status.pause_state = 1;
+		os.pause_timer = h.pause_end-curr_time;
+	}
+	if (nqueue) {
+		os.status.program_busy = 1;
+		DEBUG_PRINT(F("restored queue elements: "));
+		DEBUG_PRINTLN(nqueue);
+	}
+	queue_changed = true;
+}
+#endif
+
+void ProgramData::set_event_time(sid_t sid, time_os_t t) {
+	sid_t i = event_pos[sid];
+	if (i==SID_NONE) {
+		i = nevents++;
+		event_sids[i] = sid;
+		event_pos[sid] = i;
+		event_times[sid] = t;
+		heap_up(i);
+	} else if (t<event_times[sid]) {
+		event_times[sid] = t;
+		heap_up(i);
+	} else {
+		event_times[sid] = t;
+		heap_down(i);
+	}
+}
+
+void ProgramData::heap_remove(sid_t sid) {
+	sid_t i = event_pos[sid];
+	if (i==SID_NONE) return;
+	event_pos[sid] = SID_NONE;
+	nevents--;
+	if (i==nevents) return;
+	sid_t moved = event_sids[nevents];
+	event_sids[i] = moved;
+	event_pos[moved] = i;
+	heap_up(i);
+	heap_down(event_pos[moved]);
+}
+
+void ProgramData::heap_swap(sid_t i, sid_t j) {
+	sid_t t = event_sids[i];
+	event_sids[i] = event_sids[j];
+	event_sids[j] = t;
+	event_pos[event_sids[i]] = i;
+	event_pos[event_sids[j]] = j;
+}
+
+void ProgramData::heap_up(sid_t i) {
+	while (i>0) {
+		sid_t parent = (i-1)/2;
+		if (event_times[event_sids[parent]]<=event_times[event_sids[i]]) break;
+		heap_swap(i, parent);
+		i = parent;
+	}
+}
+
+void ProgramData::heap_down(sid_t i) {
+	while (true) {
+		uint32_t l = 2*(uint32_t)i+1;
+		sid_t m = i;
+		if (l<nevents && event_times[event_sids[l]]<event_times[event_sids[m]]) m = l;
+		if (l+1<nevents && event_times[event_sids[l+1]]<event_times[event_sids[m]]) m = l+1;
+		if (m==i) break;
+		heap_swap(i, m);
+		i = m;
+	}
+}
+
+/** File position of program pid */
+static ulong prog_pos(pgid_t pid) {
+	return PROG_HEADER_SIZE+(ulong)pid*PROGRAMSTRUCT_SIZE;
+}
+
+/** Move a program file this build can't read out of the way
+ * Programs added from now on start a new file, and the old one is kept as a backup
+ */
+void ProgramData::set_aside() {
+	DEBUG_PRINTLN(F("incompatible program file, moved to " PROG_BACKUP_FILENAME));
+	rename_file(PROG_FILENAME, PROG_BACKUP_FILENAME);
+	nprograms = 0;
+	save_count();
 }
 
-/** Load program count from program file */
+/** Load program count from program file
+ * A legacy file (one-byte count, programs from offset 1) is converted in place,
+ * unless it is too short to hold its programs at this build's record size
+ * (e.g. written by a build with a different MAX_NUM_STATIONS).
+ * Files that can't be read are set aside as PROG_BACKUP_FILENAME
+ */
 void ProgramData::load_count() {
-	nprograms = file_read_byte(PROG_FILENAME, 0);
+	ProgramFileHeader h;
+	memset(&h, 0, sizeof(h));
+	file_read_block(PROG_FILENAME, &h, 0, sizeof(h));
+	if (h.magic != PROG_FILE_MAGIC) {
+		ProgramStruct prog;
+		nprograms = (h.magic <= MAX_NUM_PROGRAMS) ? h.magic : 0;
+		if (nprograms && file_size(PROG_FILENAME) < 1+(ulong)nprograms*PROGRAMSTRUCT_SIZE) {
+			set_aside();
+			return;
+		}
+		// move programs back to make room for the header, starting from the last one
+		for (pgid_t pid = nprograms; pid > 0; pid--) {
+			file_copy_block(PROG_FILENAME, 1+(ulong)(pid-1)*PROGRAMSTRUCT_SIZE, prog_pos(pid-1), PROGRAMSTRUCT_SIZE, &prog);
+		}
+		save_count();
+	} else if (h.version > PROG_FILE_VERSION || h.record_size != PROGRAMSTRUCT_SIZE || h.nprograms > MAX_NUM_PROGRAMS) {
+		set_aside();
+		return;
+	} else {
+		nprograms = h.nprograms;
+	}
+#if !defined(ARDUINO)
+	ProgramStruct prog;
+	for (pgid_t pid = 0; pid < nprograms; pid++) {
+		read(pid, &prog);
+		if (!sched_set(pid, &prog)) {
+			nprograms = 0; // no programs run rather than some of them
+			break;
+		}
+	}
+#endif
 }
 
 /** Save program count to program file */
 void ProgramData::save_count() {
-	file_write_byte(PROG_FILENAME, 0, nprograms);
+	ProgramFileHeader h;
+	h.magic = PROG_FILE_MAGIC;
+	h.version = PROG_FILE_VERSION;
+	h.nprograms = nprograms;
+	h.record_size = PROGRAMSTRUCT_SIZE;
+	file_write_block(PROG_FILENAME, &h, 0, sizeof(h));
 }
 
+#if !defined(ARDUINO)
+/** Copy the schedule of a program into memory, growing the table if needed
+ * Returns false if there is no memory for it */
+bool ProgramData::sched_set(pgid_t pid, const ProgramStruct *buf) {
+	if (pid >= sched_size) {
+		pgid_t n = sched_size ? sched_size*2 : 16;
+		if (n > MAX_NUM_PROGRAMS) n = MAX_NUM_PROGRAMS;
+		ProgramSched *p = (ProgramSched*)realloc(sched, n*sizeof(ProgramSched));
+		if (!p) {
+			DEBUG_PRINTLN(F("out of memory for programs"));
+			return false;
+		}
+		sched = p;
+		sched_size = n;
+	}
+	memcpy(sched[pid].head, buf, PROGRAM_SCHED_HEAD_SIZE);
+	sched[pid].daterange[0] = buf->daterange[0];
+	sched[pid].daterange[1] = buf->daterange[1];
+	return true;
+}
+#endif
+
 /** Erase all program data */
 void ProgramData::eraseall() {
 	nprograms = 0;
@@ -98,32 +705,54 @@ void ProgramData::eraseall() {
 }
 
 /** Read a program from program file*/
-void ProgramData::read(unsigned char pid, ProgramStruct *buf) {
+void ProgramData::read(pgid_t pid, ProgramStruct *buf) {
 	if (pid >= nprograms) return;
-	// first unsigned char is program counter, so 1+
-	file_read_block(PROG_FILENAME, buf, 1+(ulong)pid*PROGRAMSTRUCT_SIZE, PROGRAMSTRUCT_SIZE);
+	file_read_block(PROG_FILENAME, buf, prog_pos(pid), PROGRAMSTRUCT_SIZE);
+}
+
+/** Read the schedule of a program (flags, days, start times and date range)
+ * This is all check_match needs, and is much cheaper than read().
+ * Other fields of buf are left unchanged
+ */
+void ProgramData::read_sched(pgid_t pid, ProgramStruct *buf) {
+	if (pid >= nprograms) return;
+#if defined(ARDUINO)
+	file_read_block(PROG_FILENAME, buf, prog_pos(pid), PROGRAM_SCHED_HEAD_SIZE);
+	file_read_block(PROG_FILENAME, buf->daterange, prog_pos(pid)+offsetof(ProgramStruct, daterange), sizeof(buf->daterange));
+#else
+	memcpy((void*)buf, sched[pid].head, PROGRAM_SCHED_HEAD_SIZE);
+	buf->daterange[0] = sched[pid].daterange[0];
+	buf->daterange[1] = sched[pid].daterange[1];
+#endif
 }
 
 /** Add a program */
 unsigned char ProgramData::add(ProgramStruct *buf) {
 	if (nprograms >= MAX_NUM_PROGRAMS)	return 0;
-	file_write_block(PROG_FILENAME, buf, 1+(ulong)nprograms*PROGRAMSTRUCT_SIZE, PROGRAMSTRUCT_SIZE);
+#if !defined(ARDUINO)
+	if (!sched_set(nprograms, buf)) return 0;
+#endif
+	file_write_block(PROG_FILENAME, buf, prog_pos(nprograms), PROGRAMSTRUCT_SIZE);
 	nprograms ++;
 	save_count();
 	return 1;
 }
 
 /** Move a program up (i.e. swap a program with the one above it) */
-void ProgramData::moveup(unsigned char pid) {
+void ProgramData::moveup(pgid_t pid) {
 	if(pid >= nprograms || pid == 0) return;
 	// swap program pid-1 and pid
-	ulong pos = 1+(ulong)(pid-1)*PROGRAMSTRUCT_SIZE;
+	ulong pos = prog_pos(pid-1);
 	ulong next = pos+PROGRAMSTRUCT_SIZE;
-	char buf2[PROGRAMSTRUCT_SIZE];
-	file_read_block(PROG_FILENAME, tmp_buffer, pos, PROGRAMSTRUCT_SIZE);
-	file_read_block(PROG_FILENAME, buf2, next, PROGRAMSTRUCT_SIZE);
-	file_write_block(PROG_FILENAME, tmp_buffer, next, PROGRAMSTRUCT_SIZE);
-	file_write_block(PROG_FILENAME, buf2, pos, PROGRAMSTRUCT_SIZE);
+	ProgramStruct buf1, buf2;
+	file_read_block(PROG_FILENAME, &buf1, pos, PROGRAMSTRUCT_SIZE);
+	file_read_block(PROG_FILENAME, &buf2, next, PROGRAMSTRUCT_SIZE);
+	file_write_block(PROG_FILENAME, &buf1, next, PROGRAMSTRUCT_SIZE);
+	file_write_block(PROG_FILENAME, &buf2, pos, PROGRAMSTRUCT_SIZE);
+#if !defined(ARDUINO)
+	sched_set(pid-1, &buf2);
+	sched_set(pid, &buf1);
+#endif
 }
 
 void ProgramData::toggle_pause(ulong delay) {
@@ -158,6 +787,9 @@ void ProgramData::set_pause() {
 			last_seq_stop_times[gid] = q->st + q->dur; // update last_seq_stop_times of the corresponding group
 		}
 	}
+	for (q = queue; q < queue + nqueue; q++) {
+		touch_station(q->sid);
+	}
 }
 
 void ProgramData::resume_stations() {
@@ -168,6 +800,9 @@ void ProgramData::resume_stations() {
 		q->st += 1; // adjust by 1 second to give time for scheduler
 		q->deque_time += 1;
 	}
+	for (q = queue; q < queue + nqueue; q++) {
+		touch_station(q->sid);
+	}
 	clear_pause();
 }
 
@@ -175,37 +810,47 @@ void ProgramData::clear_pause() {
 	os.status.pause_state = 0;
 	os.pause_timer = 0;
 	memset(last_seq_stop_times, 0, sizeof(last_seq_stop_times));
+	seq_dirty = 0xFFFFFFFFUL; // recalculate at the next tick
 }
 
 /** Modify a program */
-unsigned char ProgramData::modify(unsigned char pid, ProgramStruct *buf) {
+unsigned char ProgramData::modify(pgid_t pid, ProgramStruct *buf) {
 	if (pid >= nprograms)  return 0;
-	ulong pos = 1+(ulong)pid*PROGRAMSTRUCT_SIZE;
-	file_write_block(PROG_FILENAME, buf, pos, PROGRAMSTRUCT_SIZE);
+	file_write_block(PROG_FILENAME, buf, prog_pos(pid), PROGRAMSTRUCT_SIZE);
+#if !defined(ARDUINO)
+	sched_set(pid, buf);
+#endif
 	return 1;
 }
 
 /** Delete program(s) */
-unsigned char ProgramData::del(unsigned char pid) {
+unsigned char ProgramData::del(pgid_t pid) {
 	if (pid >= nprograms)  return 0;
 	if (nprograms == 0) return 0;
-	ulong pos = 1+(ulong)(pid+1)*PROGRAMSTRUCT_SIZE;
+	ProgramStruct buf;
+	ulong pos = prog_pos(pid+1);
 	// erase by copying backward
-	for (; pos < 1+(ulong)nprograms*PROGRAMSTRUCT_SIZE; pos+=PROGRAMSTRUCT_SIZE) {
-		file_copy_block(PROG_FILENAME, pos, pos-PROGRAMSTRUCT_SIZE, PROGRAMSTRUCT_SIZE, tmp_buffer);
+	for (; pos < prog_pos(nprograms); pos+=PROGRAMSTRUCT_SIZE) {
+		file_copy_block(PROG_FILENAME, pos, pos-PROGRAMSTRUCT_SIZE, PROGRAMSTRUCT_SIZE, &buf);
 	}
+#if !defined(ARDUINO)
+	memmove(sched+pid, sched+pid+1, (nprograms-pid-1)*sizeof(ProgramSched));
+#endif
 	nprograms --;
 	save_count();
 	return 1;
 }
 
 // set the enable bit
-unsigned char ProgramData::set_flagbit(unsigned char pid, unsigned char bid, unsigned char value) {
+unsigned char ProgramData::set_flagbit(pgid_t pid, unsigned char bid, unsigned char value) {
 	if (pid >= nprograms)  return 0;
-	unsigned char flag = file_read_byte(PROG_FILENAME, 1+(ulong)pid*PROGRAMSTRUCT_SIZE);
+	unsigned char flag = file_read_byte(PROG_FILENAME, prog_pos(pid));
 	if(value) flag|=(1<<bid);
 	else flag&=(~(1<<bid));
-	file_write_byte(PROG_FILENAME, 1+(ulong)pid*PROGRAMSTRUCT_SIZE, flag);
+	file_write_byte(PROG_FILENAME, prog_pos(pid), flag);
+#if !defined(ARDUINO)
+	sched[pid].head[0] = flag;
+#endif
 	return 1;
 }
 
@@ -395,26 +1040,13 @@ unsigned char ProgramStruct::check_match(time_os_t t, bool *to_delete) {
 	return 0;
 }
 
-struct StationNameSortElem {
-	unsigned char idx;
-	char *name;
-};
-
-int StationNameSortAscendCmp(const void *a, const void *b) {
-	return strcmp(((StationNameSortElem*)a)->name,((StationNameSortElem*)b)->name);
-}
-
-int StationNameSortDescendCmp(const void *a, const void *b) {
-	return StationNameSortAscendCmp(b, a);
-}
-
 // generate station runorder based on the annotation in program names
 // alternating means on the odd numbered runs of the program, it uses one order; on the even runs, it uses the opposite order
-void ProgramStruct::gen_station_runorder(uint16_t runcount, unsigned char *order) {
+void ProgramStruct::gen_station_runorder(uint16_t runcount, sid_t *order) {
 	unsigned char len = strlen(name);
-	unsigned char ns = os.nstations;
+	sid_t ns = os.nstations;
 	int16_t i;
-	unsigned char temp;
+	sid_t temp;
 
 	// default order: ascending by index
 	for(i=0;i<ns;i++) {
@@ -443,20 +1075,11 @@ void ProgramStruct::gen_station_runorder(uint16_t runcount, unsigned char *order
 			case 't': // alternating: odd-numbered runs ascending by name, even-numbered runs descending.
 			case 'T': // odd-numbered runs descending by name, even-numbered runs ascending
 			{
-				StationNameSortElem elems[ns];
-				for(i=0;i<ns;i++) {
-					elems[i].idx=i;
-					os.get_station_name(i,tmp_buffer);
-					elems[i].name=strdup(tmp_buffer);
-				}
-				if((anno=='n') || ((anno=='t') && (runcount%2==1)) || ((anno=='T') && (runcount%2==0))) {
-					qsort(elems, ns, sizeof(StationNameSortElem), StationNameSortAscendCmp);
-				} else {
-					qsort(elems, ns, sizeof(StationNameSortElem), StationNameSortDescendCmp);
-				}
+				// copy the stations in name order
+				const sid_t *sorted = os.get_name_order();
+				bool ascend = (anno=='n') || ((anno=='t') && (runcount%2==1)) || ((anno=='T') && (runcount%2==0));
 				for(i=0;i<ns;i++) {
-					order[i]=elems[i].idx;
-					free(elems[i].name);
+					order[i] = sorted[ascend ? i : ns-1-i];
 				}
 			}
 			break;
@@ -466,7 +1089,7 @@ void ProgramStruct::gen_station_runorder(uint16_t runcount, unsigned char *order
 
 			{
 				for(i=0;i<ns-1;i++) { // todo: need random seeding
-					unsigned char sel = (rand()%(ns-i))+i;
+					sid_t sel = (rand()%(ns-i))+i;
 					temp = order[i]; // swap order[i] with order[sel]
 					order[i] = order[sel];
 					order[sel] = temp;
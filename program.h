@@ -25,18 +25,85 @@
 #ifndef _PROGRAM_H
 #define _PROGRAM_H
 
+#if defined(ARDUINO)
 #define MAX_NUM_PROGRAMS    40  // maximum number of programs
+#else
+#define MAX_NUM_PROGRAMS    500
+#endif
 #define MAX_NUM_STARTTIMES  4
 #define PROGRAM_NAME_SIZE   32
+#if defined(LARGE_INSTALL)
+#define RUNTIME_QUEUE_SIZE  (ProgramData::queue_size) // allocated at runtime, and grown as needed
+#else
 #define RUNTIME_QUEUE_SIZE  MAX_NUM_STATIONS
+#endif
 #define PROGRAMSTRUCT_SIZE  sizeof(ProgramStruct)
+#if defined(ARDUINO)
+#define MAX_MASTER_WINDOWS  8   // on-windows kept per master (more are picked up as earlier ones pass)
+#else
+#define MAX_MASTER_WINDOWS  64
+#endif
 #include "OpenSprinkler.h"
 #include "types.h"
+#include <stddef.h>
+
+/** Program ids of queued runs that don't come from a stored program
+ * (stored programs are queued as their index + 1) */
+#if defined(ARDUINO)
+#define PROGRAM_ID_MANUAL   99    // station started manually
+#define PROGRAM_ID_RUNONCE  254   // run-once or manually started program
+#define PROGRAM_ID_TEST     255   // short test program (2 seconds per station)
+#else
+#define PROGRAM_ID_MANUAL   0xFF63
+#define PROGRAM_ID_RUNONCE  0xFFFE
+#define PROGRAM_ID_TEST     0xFFFF
+#endif
+
+/** Program id as the status JSON and log files report it:
+ * manual, run-once and test runs keep their 8-bit ids there (99, 254, 255) */
+#if defined(ARDUINO)
+#define wire_pid(pid) (pid)
+#else
+inline unsigned int wire_pid(pgid_t pid) { return (pid>=PROGRAM_ID_MANUAL) ? pid-0xFF00 : pid; }
+#endif
+
+/** prog.dat header. Files written before the header existed
+ * start with a one-byte program count instead, and are converted on load */
+struct ProgramFileHeader {
+	unsigned char magic;     // PROG_FILE_MAGIC (never a valid legacy program count)
+	unsigned char version;   // PROG_FILE_VERSION
+	uint16_t nprograms;      // number of programs
+	uint16_t record_size;    // PROGRAMSTRUCT_SIZE of the firmware that wrote the file
+};
+#define PROG_FILE_MAGIC     0xA5
+#define PROG_FILE_VERSION   1
+#define PROG_HEADER_SIZE    sizeof(ProgramFileHeader)
+
+#if !defined(ARDUINO)
+/** queue.dat: snapshot of the runtime queue, written when the queue changes */
+struct QueueFileHeader {
+	unsigned char magic;     // QUEUE_FILE_MAGIC
+	unsigned char version;   // QUEUE_FILE_VERSION
+	uint16_t record_size;    // sizeof(QueueRecord) of the firmware that wrote the file
+	uint32_t nqueue;         // number of records that follow
+	time_os_t pause_end;     // end of the pause in progress (0 if not paused)
+};
+struct QueueRecord {
+	time_os_t st;
+	time_os_t deque_time;
+	uint16_t dur;
+	uint16_t dur_ms;
+	uint16_t sid;
+	uint16_t pid;
+};
+#define QUEUE_FILE_MAGIC    0x51
+#define QUEUE_FILE_VERSION  1
+#endif
 
 /** Log data structure */
 struct LogStruct {
-	unsigned char station;
-	unsigned char program;
+	sid_t station;
+	pgid_t program;
 	uint16_t duration;
 	uint32_t endtime;
 };
@@ -105,7 +172,7 @@ public:
 
 	int16_t daterange[2] = {MIN_ENCODED_DATE, MAX_ENCODED_DATE}; // date range: start date, end date
 	unsigned char check_match(time_os_t t, bool *to_delete);
-	void gen_station_runorder(uint16_t runcount, unsigned char *order);
+	void gen_station_runorder(uint16_t runcount, sid_t *order);
 	int16_t starttime_decode(int16_t t);
 
 protected:
@@ -114,23 +181,60 @@ protected:
 
 };
 
+/** The part of a program that check_match looks at */
+#define PROGRAM_SCHED_HEAD_SIZE  offsetof(ProgramStruct, durations)
+struct ProgramSched {
+	unsigned char head[PROGRAM_SCHED_HEAD_SIZE]; // flags, days and start times
+	int16_t daterange[2];
+};
+
 extern OpenSprinkler os;
 
 class RuntimeQueueStruct {
 public:
 	time_os_t   st;  // start time
 	uint16_t dur; // water time
-	unsigned char  sid;
-	unsigned char  pid;
+	sid_t  sid;
+	pgid_t pid;
+#if !defined(ARDUINO)
+	uint16_t dur_ms; // if non-zero, the run ends dur_ms milliseconds into its last second (st+dur-1)
+#endif
 	time_os_t   deque_time; // deque time, which can be larger than st+dur to allow positive master off adjustment time
+	// links below are maintained by ProgramData (QID_NONE means none)
+	unsigned char  gid;   // sequential group this element is linked into (PARALLEL_GROUP_ID if none)
+	qid_t  snext; // next element of the same station, in start time order
+	qid_t  gprev; // previous element of the same sequential group
+	qid_t  gnext; // next element of the same sequential group
+};
+
+/** Merged on-windows of a master station, in time order
+ * Each bound queue element contributes [st+on_adj, st+dur+off_adj];
+ * overlapping and adjacent windows are merged
+ */
+struct MasterWindows {
+	unsigned char sid;      // master station (1-based) the list was built for
+	int16_t on_adj, off_adj;
+	unsigned char n;        // number of windows
+	unsigned char cur;      // first window that hasn't ended yet
+	time_os_t built;        // time the list was built at
+	time_os_t horizon;      // if non-zero, windows starting at or after this time were left out
+	time_os_t on[MAX_MASTER_WINDOWS];
+	time_os_t off[MAX_MASTER_WINDOWS];
 };
 
 class ProgramData {
 public:
+#if defined(LARGE_INSTALL)
+	static RuntimeQueueStruct *queue;
+	static qid_t queue_size;      // number of allocated queue elements
+	static qid_t *station_qid;    // sized to the number of stations by reset_runtime
+#else
 	static RuntimeQueueStruct queue[];
-	static unsigned char nqueue;  // number of queue elements
-	static unsigned char station_qid[];  // this array stores the queue element index for each scheduled station
-	static unsigned char nprograms;  // number of programs
+	static qid_t station_qid[];  // this array stores the queue element index for each scheduled station
+#endif
+	static qid_t nqueue;  // number of queue elements
+	static qid_t group_qid[];    // first queue element of each sequential group
+	static pgid_t nprograms;  // number of programs
 	static LogStruct lastrun;
 	static time_os_t last_seq_stop_times[]; // the last stop time of a sequential station (for each sequential group respectively)
 
@@ -140,22 +244,71 @@ public:
 	static void clear_pause();
 
 	static void reset_runtime();
+#if defined(LARGE_INSTALL)
+	static sid_t resize_tables(sid_t n); // grow the per-station tables to n stations, returns how many they hold
+#endif
 	static RuntimeQueueStruct* enqueue(); // this returns a pointer to the next available slot in the queue
-	static void dequeue(unsigned char qid);  // this removes an element from the queue
+	static RuntimeQueueStruct* enqueue(sid_t sid, ulong dur, pgid_t pid, time_os_t curr_time); // queue a run, merging it with the station's pending run
+	static void dequeue(qid_t qid);  // this removes an element from the queue
+	static void link(qid_t qid); // link a scheduled element to its station and group
+	static void touch_station(sid_t sid); // re-evaluate a station at the next tick
+	static sid_t next_due_station(time_os_t curr_time); // station with the earliest due event, or SID_NONE
+	static void update_station(sid_t sid, time_os_t curr_time); // drop expired elements, compute next event
+	static void update_seq_stop_times(); // recalculate last_seq_stop_times of changed groups
+	static sid_t get_active_stations(sid_t *sids); // copy the queued stations into sids, return their count
+#if !defined(ARDUINO)
+	static void save_queue(time_os_t curr_time); // write the queue snapshot if the queue has changed
+	static void restore_queue(time_os_t curr_time); // reload the queue snapshot after a restart
+#endif
+	static unsigned char master_on(unsigned char mas, time_os_t curr_time); // whether master mas should be on
+	static void invalidate_master_windows() { mas_dirty = (1<<NUM_MASTER_ZONES)-1; } // call when station-master bindings change
 
 	static void init();
 	static void eraseall();
-	static void read(unsigned char pid, ProgramStruct *buf);
+	static void read(pgid_t pid, ProgramStruct *buf);
+	static void read_sched(pgid_t pid, ProgramStruct *buf); // read only the fields check_match needs
 	static unsigned char add(ProgramStruct *buf);
-	static unsigned char modify(unsigned char pid, ProgramStruct *buf);
-	static unsigned char set_flagbit(unsigned char pid, unsigned char bid, unsigned char value);
-	static void moveup(unsigned char pid);
-	static unsigned char del(unsigned char pid);
+	static unsigned char modify(pgid_t pid, ProgramStruct *buf);
+	static unsigned char set_flagbit(pgid_t pid, unsigned char bid, unsigned char value);
+	static void moveup(pgid_t pid);
+	static unsigned char del(pgid_t pid);
 	static void drem_to_relative(unsigned char days[2]); // absolute to relative reminder conversion
 	static void drem_to_absolute(unsigned char days[2]);
 private:
 	static void load_count();
+	static void set_aside();
 	static void save_count();
+#if !defined(ARDUINO)
+	static bool sched_set(pgid_t pid, const ProgramStruct *buf);
+	static ProgramSched *sched;           // in-memory copy of each program's schedule, grown as programs are added
+	static pgid_t sched_size;             // number of allocated entries
+#endif
+	static void unlink(qid_t qid);
+	static void heap_swap(sid_t i, sid_t j);
+	static void heap_up(sid_t i);
+	static void heap_down(sid_t i);
+	static void heap_remove(sid_t sid);
+	static void set_event_time(sid_t sid, time_os_t t);
+	static sid_t nevents;                 // number of stations in the event heap
+#if defined(LARGE_INSTALL)
+	static bool grow_queue();
+	static sid_t table_size;              // number of stations the tables below are allocated for
+	static sid_t *event_sids;
+	static sid_t *event_pos;
+	static time_os_t *event_times;
+#else
+	static sid_t event_sids[];            // queued stations, as a min-heap ordered by next event time
+	static sid_t event_pos[];             // heap position of each station (SID_NONE if not queued)
+	static time_os_t event_times[];       // next start, stop or dequeue time of each station
+#endif
+	static uint32_t seq_dirty;            // bit mask of sequential groups whose stop time needs updating
+	static void build_master_windows(unsigned char mas, time_os_t curr_time);
+	static void add_master_window(MasterWindows *w, time_os_t on, time_os_t off);
+	static MasterWindows mas_windows[];
+	static unsigned char mas_dirty;       // bit mask of masters whose windows need rebuilding
+#if !defined(ARDUINO)
+	static bool queue_changed;            // the queue snapshot is out of date
+#endif
 };
 
 #endif  // _PROGRAM_H
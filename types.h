@@ -9,4 +9,20 @@ typedef unsigned long time_os_t;
 typedef time_t time_os_t;
 #endif
 
+#if defined(LARGE_INSTALL) // large-install build: more than 255 stations
+typedef uint16_t sid_t;  // station index
+typedef uint16_t qid_t;  // runtime queue index
+#else
+typedef unsigned char sid_t;
+typedef unsigned char qid_t;
+#endif
+#define SID_NONE ((sid_t)~0)
+#define QID_NONE ((qid_t)~0)
+
+#if defined(ARDUINO)
+typedef unsigned char pgid_t;  // program index
+#else
+typedef uint16_t pgid_t;
+#endif
+
 #endif
\ No newline at end of file
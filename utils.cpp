@@ -40,6 +40,16 @@ extern OpenSprinkler os;
 #else // RPI/LINUX
 
 #include <stdio.h>
+#if defined(__linux__)
+	#include <errno.h>
+	#include <fcntl.h>
+	#include <netdb.h>
+	#include <netinet/in.h>
+	#include <sys/socket.h>
+	#include <sys/stat.h>
+	#include <sys/epoll.h>
+	#include <sys/timerfd.h>
+#endif
 
 char* get_runtime_path() {
 	static char path[PATH_MAX];
@@ -163,6 +173,170 @@ ulong micros (void)
 	return (ulong)(now - epochMicro) ;
 }
 
+#if defined(__linux__)
+#define EVENT_ACTIVE_MS   20   // after any activity, keep looping every ms for this long
+#define EVENT_DRAIN_FLAG  (1ULL<<32)
+
+static int epoll_fd = -2;  // -2: not yet created, -1: unavailable
+static int timer_fd = -1;
+static int edge_fd = -1;   // high-resolution timer for millisecond switching
+static time_t timer_sec = 0;
+static ulong event_active_until = 0;
+
+static int event_add(int fd, bool drain) {
+	struct epoll_event ev;
+	ev.events = EPOLLIN | EPOLLET; // edge triggered, so unread data can't keep waking us up
+	ev.data.u64 = (uint64_t)fd | (drain ? EVENT_DRAIN_FLAG : 0);
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0 || errno == EEXIST) return 0;
+	return -1;
+}
+
+static bool event_setup() {
+	if (epoll_fd == -2) {
+		epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (epoll_fd >= 0) timer_fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+		if (epoll_fd >= 0) edge_fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+		if (timer_fd < 0 || event_add(timer_fd, true) || edge_fd < 0 || event_add(edge_fd, true)) {
+			DEBUG_PRINTLN("epoll/timerfd unavailable, polling every ms");
+			if (epoll_fd >= 0) close(epoll_fd);
+			epoll_fd = -1;
+		}
+	}
+	return epoll_fd >= 0;
+}
+
+/** Whether a connected socket's remote end is one of the addresses in ai, on port */
+static bool socket_peer_is(int fd, const struct addrinfo *ai, uint16_t port) {
+	struct sockaddr_storage sa;
+	socklen_t len = sizeof(sa);
+	if (getpeername(fd, (struct sockaddr*)&sa, &len) != 0) return false;
+	for (; ai; ai = ai->ai_next) {
+		if (ai->ai_family != sa.ss_family) continue;
+		if (sa.ss_family == AF_INET) {
+			struct sockaddr_in *x = (struct sockaddr_in*)&sa, *y = (struct sockaddr_in*)ai->ai_addr;
+			if (ntohs(x->sin_port) == port && x->sin_addr.s_addr == y->sin_addr.s_addr) return true;
+		} else if (sa.ss_family == AF_INET6) {
+			struct sockaddr_in6 *x = (struct sockaddr_in6*)&sa, *y = (struct sockaddr_in6*)ai->ai_addr;
+			if (ntohs(x->sin6_port) == port && !memcmp(&x->sin6_addr, &y->sin6_addr, sizeof(x->sin6_addr))) return true;
+		}
+	}
+	return false;
+}
+
+/** Wake up wait_for_events at an exact (wall clock) time
+ * Without epoll the loop polls every ms, which is as good as it gets
+ */
+void event_wake_at(time_t sec, long nsec) {
+	if (!event_setup()) return;
+	struct itimerspec its;
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = sec;
+	its.it_value.tv_nsec = nsec;
+	timerfd_settime(edge_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+int event_watch(int fd) {
+	if (fd < 0 || !event_setup()) return -1;
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	return event_add(fd, true) ? -1 : fd;
+}
+
+/** Watch a socket owned by someone else, who does the reading
+ * Closed sockets drop out of epoll by themselves, so there is no unwatch.
+ */
+int event_watch_socket(int fd) {
+	if (fd < 0 || !event_setup()) return -1;
+	return event_add(fd, false) ? -1 : fd;
+}
+
+/** Watch the sockets a library opened without telling us the descriptors
+ * Call it right after they are created: it picks the listening sockets (peer_host=NULL),
+ * or the connections to peer_host:peer_port, matched by address and port, so that
+ * connections to other servers on the same port are left alone.
+ */
+int event_watch_sockets(const char *peer_host, uint16_t peer_port) {
+	if (!event_setup()) return -1;
+	struct addrinfo *ai = NULL;
+	if (peer_host) {
+		struct addrinfo hints;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_socktype = SOCK_STREAM;
+		if (getaddrinfo(peer_host, NULL, &hints, &ai) != 0) return -1;
+	}
+	int found = 0;
+	struct stat st;
+	for (int fd = 0; fd < FD_SETSIZE; fd++) {
+		if (fstat(fd, &st) != 0 || !S_ISSOCK(st.st_mode)) continue;
+		int listening = 0;
+		socklen_t len = sizeof(listening);
+		if (getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &len) != 0) continue;
+		if (peer_host ? (!listening && socket_peer_is(fd, ai, peer_port)) : listening) {
+			if (event_add(fd, false) == 0) found++;
+		}
+	}
+	if (ai) freeaddrinfo(ai);
+	return found;
+}
+
+void wait_for_events(ulong max_ms) {
+	if (!event_setup()) {
+		delay(1);
+		return;
+	}
+	ulong now = millis();
+	// requests and sensor pulses tend to come in bursts, so poll for a while after each one
+	if ((long)(event_active_until - now) > 0) max_ms = 1;
+	if (max_ms > 1000) max_ms = 1000;
+
+	// wake up at the start of the next second, or when the clock is set
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	if (timer_sec != ts.tv_sec + 1) {
+		struct itimerspec its;
+		memset(&its, 0, sizeof(its));
+		its.it_value.tv_sec = timer_sec = ts.tv_sec + 1;
+		timerfd_settime(timer_fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &its, NULL);
+	}
+
+	struct epoll_event evs[8];
+	int n = epoll_wait(epoll_fd, evs, 8, (int)max_ms);
+	bool active = false;
+	for (int i = 0; i < n; i++) {
+		int fd = (int)(evs[i].data.u64 & 0xFFFFFFFF);
+		if (evs[i].data.u64 & EVENT_DRAIN_FLAG) {
+			char buf[256];
+			while (read(fd, buf, sizeof(buf)) > 0) ;
+			if (fd == timer_fd) {
+				timer_sec = 0; // expired or cancelled by a clock change, re-arm next time
+				continue;
+			}
+			if (fd == edge_fd) continue;
+		}
+		active = true;
+	}
+	if (active) event_active_until = millis() + EVENT_ACTIVE_MS;
+}
+#else
+int event_watch(int fd) { return -1; }
+int event_watch_socket(int fd) { return -1; }
+int event_watch_sockets(const char *peer_host, uint16_t peer_port) { return -1; }
+void event_wake_at(time_t sec, long nsec) {}
+void wait_for_events(ulong max_ms) { delay(1); }
+#endif
+
+/** Milliseconds in the fractional part of a number of seconds, e.g. 250 for "2.25" */
+uint16_t parse_ms_fraction(const char *s) {
+	const char *p = strchr(s, '.');
+	uint16_t ms = 0;
+	if (!p) return 0;
+	for (unsigned char i = 0; i < 3; i++) {
+		ms *= 10;
+		if (*(++p) >= '0' && *p <= '9') ms += *p - '0';
+		else p--; // keep padding with zeros
+	}
+	return ms;
+}
+
 #if defined(OSPI)
 unsigned int detect_rpi_rev() {
 	FILE * filp;
@@ -329,6 +503,59 @@ bool file_exists(const char *fn) {
 #endif
 }
 
+ulong file_size(const char *fn) {
+#if defined(ESP8266)
+
+	File f = LittleFS.open(fn, "r");
+	if(!f) return 0;
+	ulong size = f.size();
+	f.close();
+	return size;
+
+#elif defined(ARDUINO)
+
+	sd.chdir("/");
+	SdFile file;
+	if(!file.open(fn, O_READ)) return 0;
+	ulong size = file.fileSize();
+	file.close();
+	return size;
+
+#else
+
+	FILE *fp = fopen(get_filename_fullpath(fn), "rb");
+	if(!fp) return 0;
+	fseek(fp, 0, SEEK_END);
+	ulong size = ftell(fp);
+	fclose(fp);
+	return size;
+
+#endif
+}
+
+/** Rename a file, replacing any file called to */
+bool rename_file(const char *from, const char *to) {
+#if defined(ESP8266)
+
+	if(LittleFS.exists(to)) LittleFS.remove(to);
+	return LittleFS.rename(from, to);
+
+#elif defined(ARDUINO)
+
+	sd.chdir("/");
+	if (sd.exists(to)) sd.remove(to);
+	return sd.rename(from, to);
+
+#else
+
+	char path[PATH_MAX];
+	strncpy(path, get_filename_fullpath(from), PATH_MAX-1);
+	path[PATH_MAX-1] = 0;
+	return rename(path, get_filename_fullpath(to)) == 0;
+
+#endif
+}
+
 // file functions
 void file_read_block(const char *fn, void *dst, ulong pos, ulong len) {
 #if defined(ESP8266)
@@ -363,6 +590,47 @@ void file_read_block(const char *fn, void *dst, ulong pos, ulong len) {
 #endif
 }
 
+/** Read n fields of len bytes, one every stride bytes from pos, opening the file once */
+void file_read_fields(const char *fn, void *dst, ulong pos, ulong stride, ulong len, ulong n) {
+	unsigned char *d = (unsigned char*)dst;
+	memset(dst, 0, len*n); // fields past the end of the file read as empty
+#if defined(ESP8266)
+
+	File f = LittleFS.open(fn, "r");
+	if(f) {
+		for(ulong i=0;i<n;i++,d+=len) {
+			f.seek(pos+i*stride, SeekSet);
+			f.read(d, len);
+		}
+		f.close();
+	}
+
+#elif defined(ARDUINO)
+
+	sd.chdir("/");
+	SdFile file;
+	if(file.open(fn, O_READ)) {
+		for(ulong i=0;i<n;i++,d+=len) {
+			file.seekSet(pos+i*stride);
+			file.read(d, len);
+		}
+		file.close();
+	}
+
+#else
+
+	FILE *fp = fopen(get_filename_fullpath(fn), "rb");
+	if(fp) {
+		for(ulong i=0;i<n;i++,d+=len) {
+			fseek(fp, pos+i*stride, SEEK_SET);
+			fread(d, 1, len, fp);
+		}
+		fclose(fp);
+	}
+
+#endif
+}
+
 void file_write_block(const char *fn, const void *src, ulong pos, ulong len) {
 #if defined(ESP8266)
 
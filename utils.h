@@ -42,8 +42,11 @@
 //remove unused functions: void read_from_file(const char *fname, char *data, ulong maxsize=TMP_BUFFER_SIZE, int pos=0);
 void remove_file(const char *fname);
 bool file_exists(const char *fname);
+ulong file_size(const char *fname); // 0 if the file doesn't exist
+bool rename_file(const char *from, const char *to);
 
 void file_read_block (const char *fname, void *dst, ulong pos, ulong len);
+void file_read_fields(const char *fname, void *dst, ulong pos, ulong stride, ulong len, ulong n); // n fields, stride bytes apart
 void file_write_block(const char *fname, const void *src, ulong pos, ulong len);
 void file_copy_block (const char *fname, ulong from, ulong to, ulong len, void *tmp=0);
 unsigned char file_read_byte (const char *fname, ulong pos);
@@ -86,6 +89,12 @@ void str2mac(const char *_str, unsigned char mac[]);
 	ulong millis();
 	ulong micros();
 	void initialiseEpoch();
+	int event_watch(int fd); // make fd wake up wait_for_events, returns fd or -1 if not supported
+	int event_watch_socket(int fd); // same for a socket read by its owner, fd is left as is
+	int event_watch_sockets(const char *peer_host, uint16_t peer_port); // same for the listening sockets (peer_host=NULL) or connections to peer_host:peer_port, returns how many
+	void event_wake_at(time_t sec, long nsec); // make wait_for_events return at this wall clock time
+	uint16_t parse_ms_fraction(const char *s);
+	void wait_for_events(ulong max_ms); // sleep until a watched fd or socket is ready, the next second starts, or max_ms passes
 	#if defined(OSPI)
 	unsigned int detect_rpi_rev();
 	char* get_runtime_path();